@@ -22,28 +22,34 @@ cdef double little_below_one = 1. - 1e-6
 cdef double little_above_one = 1. + 1e-6
 
 #-----------Hydro reader class--------------------------------------
-cdef inline double finterp(double *** c, double rx, double ry, double rz):
-	cdef double result = 0.0
-	cdef size_t i, j, k
-	cdef double vx[2]
-	vx[0] = 1. - rx; vx[1] = rx
-	cdef double vy[2]
-	vy[0] = 1. - ry; vy[1] = ry
-	cdef double vz[2]
-	vz[0] = 1. - rz; vz[1] = rz
-	for i in range(2):
-		for j in range(2):
-			for k in range(2):
-				result += c[i][j][k]*vx[i]*vy[j]*vz[k]
-	return result
+# the frames and their interpolation live in the C++ Medium,
+# this class only reads the hydro file into it
+cdef extern from "../src/Medium.h":
+	cdef cppclass CMedium "Medium":
+		CMedium(bool dynamic)
+		void set_grid(double xmin, double xmax, double ymin, double ymax,
+				double dx, double dy, size_t Nx, size_t Ny)
+		void set_frame(size_t k, const double * T, const double * vx,
+				const double * vy)
+		void set_time(double tnow, double dtau)
+		void set_static(double dtau, double T, double vx, double vy, double vz)
+		void interpolate(size_t n, const double * tau, const double * x,
+				double * T, double * v) nogil
+
+cdef extern from "../src/FrameStream.h":
+	cdef cppclass FrameStream:
+		FrameStream(string fname)
+		size_t size()
+		void load(CMedium & medium, size_t index) nogil
 
 cdef class Medium:
-	cdef object _f, _step_keys, info_keys, static_property, _tabs
+	cdef object _f, _step_keys, info_keys, static_property
 	cdef str _mode
 	cdef public size_t _Nx, _Ny, _step_key_index
 	cdef public double _dx, _dy, _xmin, _ymin, _xmax, _ymax, _tstart, _dt, _tnow
 	cdef double T_static
-	cdef double *** interpcube
+	cdef CMedium * cmedium
+	cdef FrameStream * stream
 	cdef bool status
 
 	def __cinit__(self, medium_flags):
@@ -64,6 +70,7 @@ cdef class Medium:
 			self._ymax = 0.
 			self._tnow = self._tstart - self._dt
 			self.status = True
+			self.cmedium = new CMedium(False)
 		elif self._mode == 'dynamic':
 			hydrofilename = medium_flags['hydrofile']
 			if hydrofilename == None:
@@ -87,14 +94,18 @@ cdef class Medium:
 			self._ymax = self._f['Event'].attrs['YH']*self._dy
 			self._tnow = self._tstart - self._dt
 
-			self.interpcube = <double ***> malloc(2*sizeof(double**))
-			for i in range(2):
-				self.interpcube[i] = <double **> malloc(2*sizeof(double*))
-				for j in range(2):
-					self.interpcube[i][j] = <double *> malloc(2*sizeof(double))
+			self.cmedium = new CMedium(True)
+			self.cmedium.set_grid(self._xmin, self._xmax, self._ymin, self._ymax,
+								self._dx, self._dy, self._Nx, self._Ny)
+			# reads the frames into cmedium, the next one in the background
+			self.stream = new FrameStream(hydrofilename)
 		else:
 			raise ValueError("Medium mode not implemented.")
 
+	def __dealloc__(self):
+		del self.stream
+		del self.cmedium
+
 	cpdef init_tau(self):
 		return self._tstart
 	cpdef hydro_status(self):
@@ -104,15 +115,14 @@ cdef class Medium:
 	cpdef boundary(self):
 		return self._xmin, self._xmax, self._ymin, self._ymax
 
+	cdef read_frame(self, size_t index, key):
+		return np.ascontiguousarray(
+			self._f['Event'][self._step_keys[index]][key].value, dtype=np.double)
+
 	cdef frame_inc_unpack(self):
-		self._tabs = {}
-		cdef vector[vector[vector[double]]] buff
-		buff.resize(2)
-		for key2 in self.info_keys:
-			for i in range(2):
-				key1 = self._step_keys[self._step_key_index+i]
-				buff[i] = self._f['Event'][key1][key2].value
-			self._tabs.update({key2:buff})
+		cdef size_t index = self._step_key_index
+		with nogil:
+			self.stream.load(deref(self.cmedium), index)
 		self._step_key_index += 1
 		if self._step_key_index == len(self._step_keys) - 1:
 			self.status = False
@@ -125,47 +135,40 @@ cdef class Medium:
 				raise ValueError("Requires static meidum properties")
 			else:
 				self.static_property = StaticProperty
+				self.cmedium.set_static(self._dt, StaticProperty['Temp'],
+						StaticProperty['Vx'], StaticProperty['Vy'],
+						StaticProperty['Vz'])
 		else:
 			raise ValueError("Medium mode not implemented.")
 		self._tnow += self._dt
+		self.cmedium.set_time(self._tnow, self._dt)
 
 	cpdef get_current_frame(self, key):
-		return np.array(self._tabs[key][0])
+		return self.read_frame(self._step_key_index-1, key)
+
+	# Temp, Vx, Vy and Vz at n points: tau of shape (n,), x of shape (n, 4),
+	# returns T of shape (n,) and v of shape (n, 3)
+	cpdef interpolate(self, tau, x):
+		cdef double[::1] ctau = np.ascontiguousarray(tau, dtype=np.double)
+		cdef double[:, ::1] cx = np.ascontiguousarray(x, dtype=np.double)
+		cdef size_t n = ctau.shape[0]
+		T = np.zeros(n)
+		v = np.zeros((n, 3))
+		if n == 0:
+			return T, v
+		cdef double[::1] cT = T
+		cdef double[:, ::1] cv = v
+		with nogil:
+			self.cmedium.interpolate(n, &ctau[0], &cx[0, 0], &cT[0], &cv[0, 0])
+		return T, v
 
 	cpdef interpF(self, double tau, xvec, keys):
-		cdef double rt, nx, ny, rx, ry, gamma, buff, vz
-		cdef int ix, iy, i, j, k
 		if self._mode == "static":
 			return [self.static_property[key] for key in keys]
 		if self._mode == "dynamic":
-			if xvec[1] < self._xmin or xvec[1] > self._xmax \
-				or xvec[2] < self._ymin or xvec[2] > self._ymax:
-				return [0. for key in keys]
-			else:
-				result = []
-				rt = (tau - self._tnow)/self._dt
-				nx = (xvec[1] - self._xmin)/self._dx
-				ny = (xvec[2] - self._ymin)/self._dy
-				ix = <int>floor(nx)
-				rx = nx - ix
-				iy = <int>floor(ny)
-				ry = ny - iy
-				vz = xvec[3]/xvec[0]
-				for key in keys:
-					if key == 'Vz':
-						result.append(vz)
-					else:
-						for k in range(2):
-							for i in range(2):
-								for j in range(2):
-									self.interpcube[k][i][j] = \
-										self._tabs[key][k][ix+i][iy+j]
-						buff = finterp(self.interpcube, rt, rx, ry)
-						if key == 'Vx' or key == 'Vy':
-							gamma = 1.0/sqrt(1.0-vz*vz)
-							buff /= gamma
-						result.append(buff)
-				return result
+			T, v = self.interpolate([tau], [xvec])
+			fields = {'Temp': T[0], 'Vx': v[0, 0], 'Vy': v[0, 1], 'Vz': v[0, 2]}
+			return [fields[key] for key in keys]
 
 #-----------Production vertex sampler class-------------------------
 cdef class XY_sampler:
@@ -247,35 +250,59 @@ def rate_run(E0, T, dt=0.05, Nsteps=100, Nparticles=10000, mode="old", rescale=1
 	r = rate_test(E0, T, dt, Nsteps, Nparticles, mode, rescale)
 	return r;
 
+cdef extern from "../src/random.h" namespace "Srandom":
+	cdef void set_seed(unsigned seed)
+
+def seed(s):
+	set_seed(s)
+
 cdef extern from "../src/Langevin.h":
 	cdef void initialize_transport_coeff(double A, double B)
 	cdef void Ito_update(double dt, double M, double temp, vector[double] v3cell,
 						const fourvec & pIn, fourvec & pOut)
 
-cdef vector[double] regulate_v(vector[double] v):
-	vabs2 = v[0]**2 + v[1]**2 + v[2]**2
-	if vabs2 >= little_below_one**2:
-		scale = 1.0/sqrt(vabs2)/little_above_one
-		v[0] *= scale
-		v[1] *= scale
-		v[2] *= scale
-	return v
+cdef extern from "../src/ParticleStore.h":
+	# one array per field, vx, vy, vz of particle n at vcell[3*n+i]
+	# particles [0, nactive) are live, the rest have frozen out
+	cdef cppclass ParticleStore:
+		size_t nactive
+		vector[int] pid
+		vector[char] freezeout
+		vector[double] mass
+		vector[fourvec] x, p
+		vector[double] t_rad, t_absorb
+		vector[fourvec] p0
+		vector[double] vcell
+		vector[double] Tf
+		size_t size()
+		void resize(size_t n)
+		void clear()
+		void freestream(size_t i, double dt)
+
+cdef extern from "../src/Evolver.h":
+	cdef cppclass Evolver:
+		map[int, ParticleStore] HQ_list
+		Evolver(double Tc, bool lgv, size_t nthreads, size_t chunk_size)
+		void set_medium(const CMedium * medium)
+		void set_stepping(string mode)
+		void set_adaptive(double P_max, size_t max_substeps)
+		void set_sorting(bool sorting)
+		void step(int nsubsteps) nogil
 
 cdef class event:
-	cdef object hydro_reader, fs_reader
-	cdef map[int, vector[particle]] HQ_list
+	cdef Medium hydro_reader, fs_reader
+	cdef Evolver * evolver
 	cdef str mode, transport
 	cdef double Tc
 	cdef double tau0, tau
 	cdef bool lgv
 
 	def __cinit__(self, preeq=None, medium=None,
-			LBT=None, LGV=None, Tc=0.154):
+			LBT=None, LGV=None, Tc=0.154, nthreads=0, stepping='substeps',
+			P_max=0.05, max_substeps=100, sort=False):
 		self.mode = medium['type']
 		self.hydro_reader = Medium(medium_flags=medium)
 		self.tau0 = self.hydro_reader.init_tau()
-		self.HQ_list[4] = vector[particle]()
-		self.HQ_list[5] = vector[particle]()
 		if preeq is not None:
 			self.fs_reader = Medium(medium_flags=preeq)
 			self.tau0 = self.fs_reader.init_tau()
@@ -297,6 +324,22 @@ cdef class event:
 				initialize_transport_coeff(LGV['A'], LGV['B'])
 				self.lgv = True
 
+		# the C++ engine that owns and evolves the heavy quarks
+		self.evolver = new Evolver(self.Tc, self.lgv, nthreads, 64)
+		# 'substeps', 'event' (sampled time to the next scattering),
+		# 'adaptive' (substeps with a probability of scattering below P_max)
+		# or 'batched' (substeps, scatterings sampled grouped by channel)
+		self.evolver.set_stepping(stepping)
+		self.evolver.set_adaptive(P_max, max_substeps)
+		# order the particles by hydro cell and energy at each step
+		self.evolver.set_sorting(sort)
+
+	def __dealloc__(self):
+		del self.evolver
+
+	# the C++ engine evolves in the medium of the reader
+	cdef load_medium(self, Medium reader):
+		self.evolver.set_medium(reader.cmedium)
 
 	# The current time of the evolution.
 	def sys_time(self) :
@@ -312,11 +355,13 @@ cdef class event:
 		# for box:
 		cdef double p, cospz, sinpz
 		cdef double pmax, L
-		cdef vector[particle].iterator it
+		cdef ParticleStore * store
+		cdef size_t n
 		for pid, mass in zip([4,5],[1.3, 4.2]):
-			self.HQ_list[pid].clear()
+			store = &self.evolver.HQ_list[pid]
+			store.clear()
 			NQ = N_charm if pid == 4 else N_bottom
-			self.HQ_list[pid].resize(NQ) # NQ charm quark and NQ bottom quark, we don't need so many bottom quark
+			store.resize(NQ) # NQ charm quark and NQ bottom quark, we don't need so many bottom quark
 			if init_flags['type'] == 'A+B':
 				print("Initialize for dynamic medium")
 				HQ_xy_sampler = XY_sampler(init_flags['TAB'],
@@ -327,10 +372,9 @@ cdef class event:
 				Emax = init_flags['Emax']
 				
 				print("Heavy quarks are freestreamed to {} fm/c".format(self.tau0))
-				it = self.HQ_list[pid].begin()
 				X = []
 				Y = []
-				while it != self.HQ_list[pid].end():
+				for n in range(store.size()):
 					# Uniformly sample log(pT), phi, and ny = y/ymax
 					# ymin, ymax are determined by the max-mT
 					pT = np.exp(np.random.uniform(logpTmin, logpTmax))
@@ -348,49 +392,47 @@ cdef class event:
 					Y.append(y)
 					# Initialize positional space at tau = 0+
 					for i in range(4):
-						deref(it).p.a[i] = pcharm[i]
-						deref(it).p0.a[i] = pcharm[i]
-						deref(it).x.a[i] = r0[i]
-					deref(it).mass = mass
+						store.p[n].a[i] = pcharm[i]
+						store.p0[n].a[i] = pcharm[i]
+						store.x[n].a[i] = r0[i]
+					store.mass[n] = mass
 					# free streaming to hydro starting time tau = tau0
-					deref(it).freestream(t0)
+					store.freestream(n, t0)
 					# set last interaction vertex (assumed to be hydro start time)
-					deref(it).t_rad = t0
-					deref(it).t_absorb = t0
+					store.t_rad[n] = t0
+					store.t_absorb[n] = t0
 					# initialize others
-					deref(it).freezeout = False
-					deref(it).vcell = [0., 0., 0.]
-					deref(it).Tf = 0.
-					deref(it).pid = pid
-					inc(it)
+					store.freezeout[n] = False
+					for i in range(3):
+						store.vcell[3*n+i] = 0.
+					store.Tf[n] = 0.
+					store.pid[n] = pid
 				# check the variance of the sampling
 				stdx, stdy = np.std(X), np.std(Y)
 				print("std(x,y) = {:1.3f}, {:1.3f} [fm]".format(stdx, stdy) )
 			elif init_flags['type'] == 'probe':
 				print("Initialize for probe test")
 				E0 = init_flags['E0']
-				it = self.HQ_list[pid].begin()
 				p0 = [E0, 0, 0, sqrt(E0*E0-mass*mass)]
 				r0 = [0.0, 0.0, 0.0, 0.0]
-				while it != self.HQ_list[pid].end():
+				for n in range(store.size()):
 					for i in range(4):
-						deref(it).p.a[i] = p0[i]
-						deref(it).p0.a[i] = p0[i]
-						deref(it).x.a[i] = r0[i]
-					deref(it).mass = mass
-					deref(it).t_rad = r0[0]
-					deref(it).t_absorb = r0[0]
-					deref(it).freezeout = False
-					deref(it).vcell = [0., 0., 0.]
-					deref(it).Tf = 0.
-					deref(it).pid = pid
-					inc(it)
+						store.p[n].a[i] = p0[i]
+						store.p0[n].a[i] = p0[i]
+						store.x[n].a[i] = r0[i]
+					store.mass[n] = mass
+					store.t_rad[n] = r0[0]
+					store.t_absorb[n] = r0[0]
+					store.freezeout[n] = False
+					for i in range(3):
+						store.vcell[3*n+i] = 0.
+					store.Tf[n] = 0.
+					store.pid[n] = pid
 			elif init_flags['type'] == 'Box':
 				print("Initialize for probe test")
 				pmax = init_flags['pmax']
-				it = self.HQ_list[pid].begin()
 				r0 = [0.0, 0.0, 0.0, 0.0]
-				while it != self.HQ_list[pid].end():
+				for n in range(store.size()):
 					pT = np.random.rand()*pmax
 					phi = np.random.rand()*2*np.pi
 					cosz = np.random.rand()*2 - 1.
@@ -399,17 +441,17 @@ cdef class event:
 					p0 = [E, pT*sinz*np.cos(phi), pT*sinz*np.sin(phi), pT*cosz]
 					r0 = [0,0,0,0]
 					for i in range(4):
-						deref(it).p.a[i] = p0[i]
-						deref(it).p0.a[i] = p0[i]
-						deref(it).x.a[i] = r0[i]
-					deref(it).mass = mass
-					deref(it).t_rad = r0[0]
-					deref(it).t_absorb = r0[0]
-					deref(it).freezeout = False
-					deref(it).vcell = [0., 0., 0.]
-					deref(it).Tf = 0.
-					deref(it).pid = pid
-					inc(it)
+						store.p[n].a[i] = p0[i]
+						store.p0[n].a[i] = p0[i]
+						store.x[n].a[i] = r0[i]
+					store.mass[n] = mass
+					store.t_rad[n] = r0[0]
+					store.t_absorb[n] = r0[0]
+					store.freezeout[n] = False
+					for i in range(3):
+						store.vcell[3*n+i] = 0.
+					store.Tf[n] = 0.
+					store.pid[n] = pid
 			else:
 				raise ValueError("Initilaiztion mode not defined")
 				exit()
@@ -423,32 +465,10 @@ cdef class event:
 		status = self.fs_reader.hydro_status()
 
 		self.tau += self.fs_reader.dtau()
-		cdef double T, tau_now, smaller_dtau, T1,T2
-		cdef vector[double] vcell
-		vcell.resize(3)
-		cdef vector[particle].iterator it
-		for pid in [4,5]:
-			it = self.HQ_list[pid].begin()
-			while it != self.HQ_list[pid].end():
-				# use smaller time step than hydro
-				for substeps in range(4):
-					smaller_dtau = self.fs_reader.dtau()/4.
-					# only update HQ that are not freezeout yet
-					if not deref(it).freezeout:
-						###############################################################
-						###############################################################
-						# Get the cell temperature and velocity for this heavy quark, #
-						###############################################################
-						tau_now = sqrt(deref(it).x.t()**2 - deref(it).x.z()**2)
-						T, vcell[0], vcell[1], vcell[2] = \
-								self.fs_reader.interpF(tau_now,
-								[deref(it).x.t(),deref(it).x.x(),
-								deref(it).x.y(),deref(it).x.z()],
-								['Temp', 'Vx', 'Vy', 'Vz'])
-						#	ensure |v| < 1.
-						vcell = regulate_v(vcell)
-						self.perform_HQ_step(it, tau_now, smaller_dtau, T, vcell)
-				inc(it)
+		self.load_medium(self.fs_reader)
+		# use smaller time step than hydro
+		with nogil:
+			self.evolver.step(4)
 		return status
 
 	cpdef bool perform_hydro_step(self,
@@ -464,145 +484,45 @@ cdef class event:
 		#update system clock
 		self.tau += self.hydro_reader.dtau()
 
-		cdef double T, tau_now, smaller_dtau
-		cdef vector[double] vcell
-		vcell.resize(3)
-		cdef vector[particle].iterator it
-		for pid in [4,5]:
-			it = self.HQ_list[pid].begin()
-			while it != self.HQ_list[pid].end():
-				# use smaller time step than hydro
-				for substeps in range(10):
-					smaller_dtau = self.hydro_reader.dtau()/10.
-					# only update HQ that are not freezeout yet
-					if not deref(it).freezeout:
-						###############################################################
-						###############################################################
-						# Get the cell temperature and velocity for this heavy quark, #
-						###############################################################
-						if self.mode == "dynamic":
-							tau_now = sqrt(deref(it).x.t()**2 - deref(it).x.z()**2)
-						else:
-							tau_now = deref(it).x.t()
-						T, vcell[0], vcell[1], vcell[2] = \
-								self.hydro_reader.interpF(tau_now,
-								[deref(it).x.t(),deref(it).x.x(),
-								deref(it).x.y(),deref(it).x.z()],
-								['Temp', 'Vx', 'Vy', 'Vz'])
-						#	ensure |v| < 1.
-						vcell = regulate_v(vcell)
-						self.perform_HQ_step(it, tau_now, smaller_dtau, T, vcell)
-				inc(it)
+		self.load_medium(self.hydro_reader)
+		# use smaller time step than hydro
+		with nogil:
+			self.evolver.step(10)
 		return status
 
-	cdef perform_HQ_step(self, vector[particle].iterator it,
-						double tau_now, double dtau,
-						double T, vector[double] vcell):
-		PyErr_CheckSignals()
-		cdef vector[fourvec] final_state
-		cdef int channel
-
-		###############################################################
-		###############################################################
-		# 	if T<Tc, label it as "freezout=True"			          #
-		###############################################################
-		if T <= self.Tc:
-			deref(it).freezeout = True
-			deref(it).Tf = T
-			deref(it).vcell = vcell
-			return
-
-		###############################################################
-		###############################################################
-		# how long does it need to evolve to reach the next proper    #
-		# time step                                                   #
-		###############################################################
-		cdef double vz, t_m_zvz, one_m_vz2, dtau2, dt_lab
-		if self.mode == "dynamic":
-			vz = deref(it).p.z()/deref(it).p.t()
-			t_m_zvz = deref(it).x.t() - deref(it).x.z()*vz
-			one_m_vz2 = 1. - vz*vz
-			dtau2 = dtau*(dtau+2*tau_now)
-
-			dt_lab = \
-				(sqrt(t_m_zvz**2+one_m_vz2*dtau2) - t_m_zvz)/one_m_vz2
-		else:
-			dt_lab = dtau
-
-		###############################################################
-		###############################################################
-		# update heavy quark status, returns which scatterig channel, #
-		# and return the full final states                            #
-		###############################################################
-		# time should be in GeV^-1 in the update function !!!
-
-		channel = update_particle_momentum(
-				dt_lab*fmc_to_GeV_m1, # evolve for this time
-				T, vcell, 	# fluid info
-				deref(it).pid, # particle pid
-				(deref(it).x.t() - deref(it).t_rad)*fmc_to_GeV_m1, # LPM effect for 2->3
-				(deref(it).x.t() - deref(it).t_absorb)*fmc_to_GeV_m1, # LPM effect for 3->2
-				deref(it).p, # Initial probe momentum
-				final_state # Final states
-			)
-
-		# take down scattering info
-		#if channel >= 0:
-		#	Mt = (deref(it).p.t() - final_state[0].t())**2 - (deref(it).p.x() - final_state[0].x())**2 - (deref(it).p.y() - final_state[0].y())**2 - (deref(it).p.z() - final_state[0].z())**2
-		#	falphas.write("{}\t{}\t{}\n".format(deref(it).p.t(), T, alpha_s(Mt, T)) )
-
-		if channel < 0: # Nothing happens
-			deref(it).freestream(dt_lab)
-		elif channel == 0 or channel == 1: #elastic
-			deref(it).freestream(dt_lab)
-			deref(it).p = final_state[0]
-		elif channel == 2 or channel == 3:
-			deref(it).freestream(dt_lab)
-			deref(it).p = final_state[0]
-			deref(it).t_rad = deref(it).x.t()
-		elif channel == 4 or channel == 5:
-			deref(it).freestream(dt_lab)
-			deref(it).p = final_state[0]
-			deref(it).t_absorb = deref(it).x.t()
-		else:
-			raise ValueError("Unknown channel")
-
-		## if langevin is on, additional modification to momentum after LBT
-		cdef fourvec pOut
-		if self.lgv:
-			Ito_update(dt_lab*fmc_to_GeV_m1, deref(it).mass, T, vcell,
-						deref(it).p, pOut)
-			deref(it).p = pOut
- 
-
 	cpdef HQ_hist(self, pid):
-		cdef vector[particle].iterator it = self.HQ_list[pid].begin()
+		cdef ParticleStore * store = &self.evolver.HQ_list[pid]
+		cdef size_t n
 		cdef vector[ vector[double] ] p, x
 		p.clear()
 		x.clear()
 		cdef fourvec ix, ip
-		while it != self.HQ_list[pid].end():
-			ip = deref(it).p
-			ix = deref(it).x
+		for n in range(store.size()):
+			ip = store.p[n]
+			ix = store.x[n]
 			p.push_back([ip.t(),ip.x(),ip.y(),ip.z()])
 			x.push_back([ix.t(),ix.x(),ix.y(),ix.z()])
-			inc(it)
 		return np.array(p), np.array(x)
 
+	# number of live particles of pid, those after them have frozen out
+	cpdef HQ_active(self, pid):
+		return self.evolver.HQ_list[pid].nactive
+
 	cpdef reset(self, int pid, double E0=10.):
-		cdef vector[particle].iterator it = self.HQ_list[pid].begin()
+		cdef ParticleStore * store = &self.evolver.HQ_list[pid]
+		cdef size_t n
 		cdef double p0, rescale
-		while it != self.HQ_list[pid].end():
-			p0 = sqrt(E0**2 - deref(it).mass**2)
-			rescale = p0/sqrt(deref(it).p.x()**2 + deref(it).p.y()**2 + deref(it).p.z()**2 )
-			deref(it).p.a[1] = deref(it).p.x()*rescale
-			deref(it).p.a[2] = deref(it).p.y()*rescale
-			deref(it).p.a[3] = deref(it).p.z()*rescale
-			deref(it).p.a[0] = E0
-			inc(it)
+		for n in range(store.size()):
+			p0 = sqrt(E0**2 - store.mass[n]**2)
+			rescale = p0/sqrt(store.p[n].x()**2 + store.p[n].y()**2 + store.p[n].z()**2 )
+			store.p[n].a[1] = store.p[n].x()*rescale
+			store.p[n].a[2] = store.p[n].y()*rescale
+			store.p[n].a[3] = store.p[n].z()*rescale
+			store.p[n].a[0] = E0
 
 	cpdef output_oscar(self, pid, filename):
-		cdef vector[particle].iterator it = self.HQ_list[pid].begin()
+		cdef ParticleStore * store = &self.evolver.HQ_list[pid]
+		cdef size_t n
 		cdef size_t i=0
 		with open(filename, 'w') as f:
 			head3 = ff.FortranRecordWriter(
@@ -615,19 +535,18 @@ cdef class event:
 			eventhead =ff.FortranRecordWriter(
 					'i10,2x,i10,2x,f8.3,2x,f8.3,2x,i4,2x,i4,2X,i7')
 			f.write(
-				eventhead.write([1, self.HQ_list[pid].size(), 0.001, 0.001, 1, 1, 1])\
+				eventhead.write([1, store.size(), 0.001, 0.001, 1, 1, 1])\
 				+'\n')
-			while it != self.HQ_list[pid].end():
-				f.write(line.write([i, deref(it).pid,
-					deref(it).p.x(),deref(it).p.y(),
-					deref(it).p.z(),deref(it).p.t(),
-					deref(it).mass,
-					deref(it).x.x(),deref(it).x.y(),
-					deref(it).x.z(),deref(it).x.t(),
-					deref(it).Tf,
-					deref(it).vcell[0], deref(it).vcell[1], deref(it).vcell[2],
-					deref(it).p0.x(), deref(it).p0.y(),
-					deref(it).p0.z(), deref(it).p0.t(),
+			for n in range(store.size()):
+				f.write(line.write([i, store.pid[n],
+					store.p[n].x(),store.p[n].y(),
+					store.p[n].z(),store.p[n].t(),
+					store.mass[n],
+					store.x[n].x(),store.x[n].y(),
+					store.x[n].z(),store.x[n].t(),
+					store.Tf[n],
+					store.vcell[3*n+0], store.vcell[3*n+1], store.vcell[3*n+2],
+					store.p0[n].x(), store.p0[n].y(),
+					store.p0[n].z(), store.p0[n].t(),
 					0., 0.])+'\n')
 				i += 1
-				inc(it)
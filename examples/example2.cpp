@@ -0,0 +1,164 @@
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+
+#include "simpleLogger.h"
+#include "workflow.h"
+#include "Evolver.h"
+#include "random.h"
+
+// This sample program measures what sorting the particles buys: charm quarks
+// at random positions and energies evolve through a smooth fireball, with
+// and without sorting them by hydro cell and energy at each step. For each
+// it prints the time per step and how often the next particle of the list
+// needs another medium cell or another energy bin of the rate table.
+// To count cache misses, run each case under perf, e.g.
+//    $>perf stat -e cache-misses ./example2 old sorted
+// Before that it checks that update_particle_momentum with a scratch makes
+// no heap allocation, and fails if it does.
+
+// heap allocations of the program so far
+std::atomic<size_t> Nallocations(0);
+void * operator new(std::size_t n){
+	Nallocations ++;
+	if (void * p = std::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void * p) noexcept { std::free(p); }
+
+// heap allocations of Ncalls of update_particle_momentum with a scratch, at
+// random energies in a hot cell at rest; a first round of calls lets the
+// buffers and thread_local objects reach their sizes
+size_t count_allocations(int Ncalls, double M, double T){
+	UpdateScratch scratch;
+	FinalStates FS;
+	double v3cell[3] = {0., 0., 0.};
+	double dt = 0.1; // GeV^-1, small enough that P_total gives no warning
+	size_t count = 0, nscatter = 0;
+	for (int round=0; round<2; ++round){
+		size_t before = Nallocations;
+		nscatter = 0;
+		for (int n=0; n<Ncalls; ++n){
+			double E = M + 50.*Srandom::init_dis(Srandom::gen);
+			fourvec p{E, 0., 0., std::sqrt(E*E - M*M)};
+			int channel = update_particle_momentum(dt, T, v3cell, 4, 10., 10.,
+										p, scratch, FS);
+			if (channel >= 0) nscatter ++;
+		}
+		count = Nallocations - before;
+	}
+	LOG_INFO << Ncalls << " calls of update_particle_momentum, " << nscatter
+			 << " scatterings, " << count << " heap allocations";
+	return count;
+}
+
+// fraction of the particles whose medium cell, or energy bin, differs from
+// that of the particle before them in the list
+void locality(const Evolver & evolver, const Medium & medium,
+			double & cell_changes, double & bin_changes){
+	size_t n = 0, ncell = 0, nbin = 0;
+	for (auto & it : evolver.HQ_list){
+		size_t ix0 = 0, iy0 = 0, bin0 = 0;
+		auto & plist = it.second;
+		for (size_t i=0; i<plist.size(); ++i){
+			size_t ix, iy;
+			medium.cell(plist.x[i], ix, iy);
+			size_t bin = energy_bin(plist.pid[i], plist.p[i].t());
+			if (i > 0){
+				n ++;
+				if (ix != ix0 || iy != iy0) ncell ++;
+				if (bin != bin0) nbin ++;
+			}
+			ix0 = ix; iy0 = iy; bin0 = bin;
+		}
+	}
+	cell_changes = n ? double(ncell)/n : 0.;
+	bin_changes = n ? double(nbin)/n : 0.;
+}
+
+void run(bool sorting, const std::vector<particle> & plist,
+		Medium & medium, double tau0, double dtau, int Nsteps){
+	Evolver evolver(0.154, false);
+	evolver.set_medium(&medium);
+	evolver.set_sorting(sorting);
+	for (auto & p : plist) evolver.HQ_list[4].push_back(p);
+	Srandom::set_seed(1);
+	double cell_changes, bin_changes;
+	locality(evolver, medium, cell_changes, bin_changes);
+	auto start = std::chrono::steady_clock::now();
+	for (int it=0; it<Nsteps; ++it){
+		// the same two frames at every step
+		medium.set_time(tau0 + it*dtau, dtau);
+		evolver.step(10);
+	}
+	double wall = std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+	if (sorting) locality(evolver, medium, cell_changes, bin_changes);
+	LOG_INFO << (sorting ? "sorted" : "unsorted") << ": "
+			 << wall/Nsteps << " s per step, next particle in another cell "
+			 << cell_changes << ", in another energy bin " << bin_changes;
+}
+
+int main(int argc, char* argv[]){
+	double M = 1.3, T0 = 0.4, R = 5.;
+	double tau0 = 0.6, dtau = 0.1;
+	double xmax = 15., dxy = 0.1;
+	int Nsteps = 10, Nparticles = 100000;
+	if (argc==1){
+		std::cout << "Please tell the program whether use old table (if exists)," << std::endl;
+		std::cout << "and optionally which case to run (default both)." << std::endl;
+		std::cout << "   $>./example2 new [sorted|unsorted]" << std::endl;
+		std::cout << "Or $>./example2 old [sorted|unsorted]" << std::endl;
+		return 1;
+	}
+	std::string mode = argv[1];
+	std::string which = (argc > 2) ? argv[2] : "both";
+	initialize(mode, "./settings.xml", 1.0);
+	if (count_allocations(100000, M, T0) > 0){
+		LOG_ERROR << "update_particle_momentum allocates on the heap";
+		return 1;
+	}
+
+	// a Gaussian fireball at rest, cooling a little over a step
+	size_t N = size_t(2*xmax/dxy) + 1;
+	std::vector<double> T(N*N), v(N*N, 0.);
+	Medium medium(true);
+	medium.set_grid(-xmax, xmax, -xmax, xmax, dxy, dxy, N, N);
+	for (size_t k=0; k<2; ++k){
+		for (size_t ix=0; ix<N; ++ix)
+			for (size_t iy=0; iy<N; ++iy){
+				double x = -xmax + ix*dxy, y = -xmax + iy*dxy;
+				T[ix*N+iy] = T0*(1. - 0.05*k)*std::exp(-(x*x+y*y)/2./R/R);
+			}
+		medium.set_frame(k, T.data(), v.data(), v.data());
+	}
+
+	// random positions in the fireball and energies, at z = 0
+	std::vector<particle> plist(Nparticles);
+	Srandom::set_seed(0);
+	for (auto & p : plist){
+		double x = R*(2.*Srandom::init_dis(Srandom::gen) - 1.),
+			   y = R*(2.*Srandom::init_dis(Srandom::gen) - 1.),
+			   E = M + 50.*Srandom::init_dis(Srandom::gen),
+			   phi = 2.*M_PI*Srandom::init_dis(Srandom::gen),
+			   pT = std::sqrt(E*E - M*M);
+		p.pid = 4;
+		p.freezeout = false;
+		p.mass = M;
+		p.x = fourvec{tau0, x, y, 0.};
+		p.p = fourvec{E, pT*std::cos(phi), pT*std::sin(phi), 0.};
+		p.p0 = p.p;
+		p.t_rad = tau0;
+		p.t_absorb = tau0;
+		p.vcell = {0., 0., 0.};
+		p.Tf = 0.;
+	}
+
+	if (which != "sorted") run(false, plist, medium, tau0, dtau, Nsteps);
+	if (which != "unsorted") run(true, plist, medium, tau0, dtau, Nsteps);
+	return 0;
+}
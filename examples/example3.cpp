@@ -0,0 +1,118 @@
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <boost/property_tree/xml_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "simpleLogger.h"
+#include "workflow.h"
+#include "matrix_elements.h"
+#include "random.h"
+#include "stat.h"
+
+// This sample program checks the thermal proposal of the 3->2 rate sampler
+// against the uniform one. At a few (E, T, delta_t) it samples Qqg->Qq
+// with each, and compares the distributions of the final heavy quark and
+// light parton energies, bin by bin, with a two-sample chi^2 per bin; it
+// returns 1 if one is above chi2_max. It also prints the time and the
+// number of rejection tries per event, and the points found above the bound
+// of the thermal proposal; the tries also count those of the final 2-body
+// sampling, which are the same for both.
+// The thermal proposal is off by default, so the program runs on a copy of
+// the settings, settings32.xml, with proposal="thermal" on cqg2cq. The
+// tables go to table32.h5.
+
+const size_t Nbins = 20;
+const double chi2_max = 2.;
+
+struct result{
+	std::vector<double> hQ, hq; // energy histograms
+	double meanQ, meanq, tries, time;
+	int overflows;
+};
+
+result run(Rate32 & rate, std::string proposal, double E, double T,
+			double delta_t, int Nevents){
+	rate.set_proposal(proposal);
+	Srandom::set_seed(1);
+	SamplerStat::count_nd = 0; SamplerStat::total_nd = 0;
+	SamplerStat::count_1d = 0; SamplerStat::total_1d = 0;
+	SamplerStat::overflow_nd = 0;
+	result R{std::vector<double>(Nbins, 0.), std::vector<double>(Nbins, 0.),
+			 0., 0., 0., 0., 0};
+	// the final energies are at most E + 20 T
+	double Emax = E + 20.*T;
+	std::vector<fourvec> FS;
+	auto start = std::chrono::steady_clock::now();
+	for (int n=0; n<Nevents; ++n){
+		rate.sample({E, T, delta_t}, FS);
+		R.meanQ += FS[0].t()/Nevents;
+		R.meanq += FS[1].t()/Nevents;
+		R.hQ[std::min(size_t(FS[0].t()/Emax*Nbins), Nbins-1)] ++;
+		R.hq[std::min(size_t(FS[1].t()/Emax*Nbins), Nbins-1)] ++;
+	}
+	R.time = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count()/Nevents;
+	R.tries = double(SamplerStat::total_nd + SamplerStat::total_1d)/Nevents;
+	R.overflows = SamplerStat::overflow_nd;
+	return R;
+}
+
+// chi^2 per bin of two histograms of the same number of events
+double chi2(const std::vector<double> & a, const std::vector<double> & b){
+	double sum = 0.;
+	size_t nbins = 0;
+	for (size_t i=0; i<a.size(); ++i){
+		if (a[i]+b[i] <= 0.) continue;
+		sum += std::pow(a[i]-b[i], 2)/(a[i]+b[i]);
+		nbins ++;
+	}
+	return nbins ? sum/nbins : 0.;
+}
+
+int main(int argc, char* argv[]){
+	int Nevents = 20000;
+	if (argc==1){
+		std::cout << "Please tell the program whether use old table (if exists)," << std::endl;
+		std::cout << "and optionally the number of events per case." << std::endl;
+		std::cout << "   $>./example3 new [N]" << std::endl;
+		std::cout << "Or $>./example3 old [N]" << std::endl;
+		return 1;
+	}
+	std::string mode = argv[1];
+	if (argc > 2) Nevents = std::stoi(argv[2]);
+	std::string fname = "table32.h5";
+	boost::property_tree::ptree config;
+	std::ifstream input("./settings.xml");
+	read_xml(input, config);
+	config.put("Boltzmann.cqg2cq.<xmlattr>.proposal", "thermal");
+	write_xml("./settings32.xml", config);
+	initialize_mD_and_scale(1, 1.0);
+	Rate32 rate("Boltzmann/cqg2cq", "./settings32.xml", Ker_Qqg2Qq);
+	if (mode != "old" || !rate.loadX(fname)) rate.initX(fname);
+	if (mode != "old" || !rate.load(fname)) rate.init(fname);
+
+	double cases[3][3] = {{5., 0.2, 2.}, {10., 0.3, 5.}, {20., 0.4, 10.}};
+	bool pass = true;
+	for (auto & c : cases){
+		double E = c[0], T = c[1], delta_t = c[2];
+		auto U = run(rate, "uniform", E, T, delta_t, Nevents);
+		auto H = run(rate, "thermal", E, T, delta_t, Nevents);
+		LOG_INFO << "E = " << E << ", T = " << T << ", delta_t = " << delta_t;
+		LOG_INFO << "  uniform: <E_Q> = " << U.meanQ << ", <E_q> = " << U.meanq
+				 << ", " << U.tries << " tries, " << U.time << " s per event";
+		LOG_INFO << "  thermal: <E_Q> = " << H.meanQ << ", <E_q> = " << H.meanq
+				 << ", " << H.tries << " tries, " << H.time << " s per event, "
+				 << H.overflows << " points above the bound";
+		double cQ = chi2(U.hQ, H.hQ), cq = chi2(U.hq, H.hq);
+		LOG_INFO << "  chi2 per bin, E_Q: " << cQ << ", E_q: " << cq
+				 << " (about 1 if they agree)";
+		if (cQ > chi2_max || cq > chi2_max){
+			LOG_ERROR << "  the thermal proposal does not agree with the uniform one";
+			pass = false;
+		}
+	}
+	return pass ? 0 : 1;
+}
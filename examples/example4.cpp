@@ -0,0 +1,159 @@
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <utility>
+
+#include "simpleLogger.h"
+#include "sampler.h"
+#include "random.h"
+#include "stat.h"
+
+// This sample program checks the samplers of sampler.h on toy densities that
+// need no table. The stratified sampler draws from envelopes that are made
+// too low on purpose, and the VEGAS sampler from its adapted proposal, with
+// its bound and with one made too low. Each must agree with a plain
+// rejection against a true bound: bin by bin, in a histogram of each axis,
+// with a chi^2 per bin below chi2_max. It also prints the tries per sample
+// of the VEGAS sampler and of the plain rejection. It returns 1 if one of
+// the comparisons fails.
+//    $>./example4 [N]
+
+const size_t Nbins = 20;
+const double chi2_max = 2.;
+
+// chi^2 per bin of two histograms of the same number of events
+double chi2(const std::vector<double> & a, const std::vector<double> & b){
+	double sum = 0.;
+	size_t nbins = 0;
+	for (size_t i=0; i<a.size(); ++i){
+		if (a[i]+b[i] <= 0.) continue;
+		sum += std::pow(a[i]-b[i], 2)/(a[i]+b[i]);
+		nbins ++;
+	}
+	return nbins ? sum/nbins : 0.;
+}
+
+// histograms of each axis of N points of the sampler draw(x), over range,
+// one after the other
+template <typename D>
+std::vector<double> histogram(D draw, const std::pair<double,double> * range,
+			size_t dim, int N){
+	std::vector<double> h(dim*Nbins, 0.), x(dim);
+	for (int n=0; n<N; ++n){
+		draw(x.data());
+		for (size_t i=0; i<dim; ++i){
+			double u = (x[i] - range[i].first)/(range[i].second - range[i].first);
+			h[i*Nbins + std::min(size_t(u*Nbins), Nbins-1)] ++;
+		}
+	}
+	return h;
+}
+
+// the stratified sampler of f from the envelope maxima scaled by scale(b)
+// for sub-box b, against sample_nd with the bound fmax
+template <typename F, typename G>
+bool check_stratified(std::string name, F f, std::vector<std::pair<double,double>> range,
+			size_t S, double fmax, G scale, int N){
+	size_t dim = range.size();
+	auto maxima = envelope_maxima(f, range, S);
+	std::vector<double> cumulant(maxima.size());
+	double total = 0.;
+	for (size_t b=0; b<maxima.size(); ++b)
+		cumulant[b] = (total += maxima[b]*scale(b));
+	bool status = true;
+	SamplerStat::overflow_nd = 0;
+	auto hS = histogram([&](double * x){
+		sample_stratified(f, range.data(), dim, S, cumulant.data(), status, x);
+	}, range.data(), dim, N);
+	int overflows = SamplerStat::overflow_nd;
+	auto hN = histogram([&](double * x){
+		sample_nd(f, dim, range.data(), fmax, status, x);
+	}, range.data(), dim, N);
+	bool pass = status;
+	for (size_t i=0; i<dim; ++i){
+		std::vector<double> a(hS.begin()+i*Nbins, hS.begin()+(i+1)*Nbins),
+							b(hN.begin()+i*Nbins, hN.begin()+(i+1)*Nbins);
+		double c = chi2(a, b);
+		LOG_INFO << name << ", axis " << i << ": chi2 per bin = " << c;
+		if (c > chi2_max) pass = false;
+	}
+	LOG_INFO << name << ": " << overflows << " points above the envelope";
+	if (!pass) LOG_ERROR << name << " does not agree with sample_nd";
+	return pass;
+}
+
+// the VEGAS sampler of f, with a proposal of B bins per axis and its bound
+// divided by lower, against sample_nd with the bound fmax
+template <typename F>
+bool check_vegas(std::string name, F f, std::vector<std::pair<double,double>> range,
+			size_t B, double fmax, double lower, int N){
+	size_t dim = range.size();
+	double wmax;
+	auto edges = vegas_grid(f, range, B, wmax);
+	wmax /= lower;
+	auto edge = [&edges, B](size_t d, size_t j){return edges[d*(B+1)+j];};
+	bool status = true;
+	SamplerStat::overflow_nd = 0;
+	SamplerStat::count_nd = 0; SamplerStat::total_nd = 0;
+	auto hV = histogram([&](double * x){
+		sample_vegas(f, edge, B, range.data(), dim, wmax, status, x);
+	}, range.data(), dim, N);
+	int overflows = SamplerStat::overflow_nd;
+	double triesV = double(SamplerStat::total_nd)/SamplerStat::count_nd;
+	SamplerStat::count_nd = 0; SamplerStat::total_nd = 0;
+	auto hN = histogram([&](double * x){
+		sample_nd(f, dim, range.data(), fmax, status, x);
+	}, range.data(), dim, N);
+	double triesN = double(SamplerStat::total_nd)/SamplerStat::count_nd;
+	bool pass = status;
+	for (size_t i=0; i<dim; ++i){
+		std::vector<double> a(hV.begin()+i*Nbins, hV.begin()+(i+1)*Nbins),
+							b(hN.begin()+i*Nbins, hN.begin()+(i+1)*Nbins);
+		double c = chi2(a, b);
+		LOG_INFO << name << ", axis " << i << ": chi2 per bin = " << c;
+		if (c > chi2_max) pass = false;
+	}
+	LOG_INFO << name << ": " << triesV << " tries per sample with VEGAS, "
+			 << triesN << " in the box, " << overflows << " points above wmax";
+	if (!pass) LOG_ERROR << name << " does not agree with sample_nd";
+	return pass;
+}
+
+int main(int argc, char* argv[]){
+	int N = 200000;
+	if (argc > 1) N = std::stoi(argv[1]);
+	Srandom::set_seed(1);
+	bool pass = true;
+
+	// a smooth density, its envelope too low by 3 where most of it lies,
+	// on the first column of sub-boxes
+	size_t S = 4;
+	auto smooth = [](const double * x){return std::exp(-3.*x[0])*(1.+x[1]);};
+	pass &= check_stratified("smooth, first column 3x too low", smooth,
+			{{0., 1.}, {0., 1.}}, S, 3.,
+			[S](size_t b){return b/S == 0 ? 1./3. : 1.;}, N);
+	pass &= check_stratified("smooth, all 2x too low", smooth,
+			{{0., 1.}, {0., 1.}}, S, 3.,
+			[](size_t){return .5;}, N);
+
+	// a narrow peak between the lattice points of the envelope maxima, which
+	// then miss most of it
+	auto peak = [](const double * x){
+		return .2 + std::exp(-(std::pow(x[0]-.3, 2) + std::pow(x[1]-.55, 2))/2./.02/.02);
+	};
+	pass &= check_stratified("narrow peak", peak,
+			{{0., 1.}, {0., 1.}}, S, 1.5,
+			[](size_t){return 1.;}, N);
+
+	// a narrow 2-D gaussian off the center, as the peaks of the 2->3
+	// cross-sections, for which VEGAS is meant
+	auto gauss = [](const double * x){
+		return std::exp(-(std::pow(x[0]-.2, 2) + std::pow(x[1]-.7, 2))/2./.05/.05);
+	};
+	pass &= check_vegas("gaussian", gauss, {{0., 1.}, {0., 1.}}, 16, 1.5, 1., N);
+	pass &= check_vegas("gaussian, wmax 4x too low", gauss,
+			{{0., 1.}, {0., 1.}}, 16, 1.5, 4., N);
+
+	return pass ? 0 : 1;
+}
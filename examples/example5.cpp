@@ -0,0 +1,116 @@
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <boost/property_tree/xml_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "simpleLogger.h"
+#include "workflow.h"
+#include "Xsection.h"
+#include "matrix_elements.h"
+#include "random.h"
+#include "stat.h"
+
+// This sample program measures what the VEGAS proposal of the 2->3
+// cross-section buys: at a few (sqrts, T, delta_t) it samples Qq->Qqg from
+// the VEGAS proposal and from the uniform box, and prints the rejection
+// tries and the time per sample of each. It also compares the distributions
+// of the final heavy quark and gluon energies, bin by bin, with a two-sample
+// chi^2 per bin, and returns 1 if one is above chi2_max.
+// VEGAS is off by default, so the program runs on a copy of the settings,
+// settings23.xml, with vegas="8" on cq2cqg; the cross-section without it
+// reads the same table, table23.h5, and leaves its VEGAS grids out.
+
+typedef Xsection<3, double(*)(const double*, void*)> Xsection23;
+
+const size_t Nbins = 20;
+const double chi2_max = 2.;
+
+struct result{
+	std::vector<double> hQ, hk; // energy histograms
+	double tries, time;
+	int overflows;
+};
+
+result run(Xsection23 & X, double sqrts, double T, double delta_t, int Nsamples){
+	Srandom::set_seed(1);
+	SamplerStat::count_nd = 0; SamplerStat::total_nd = 0;
+	SamplerStat::overflow_nd = 0;
+	result R{std::vector<double>(Nbins, 0.), std::vector<double>(Nbins, 0.),
+			 0., 0., 0};
+	// in the center of mass frame, the energies are below sqrts
+	double Emax = sqrts;
+	std::vector<fourvec> FS;
+	auto start = std::chrono::steady_clock::now();
+	for (int n=0; n<Nsamples; ++n){
+		X.sample({sqrts, T, delta_t}, FS);
+		R.hQ[std::min(size_t(FS[0].t()/Emax*Nbins), Nbins-1)] ++;
+		R.hk[std::min(size_t(FS[2].t()/Emax*Nbins), Nbins-1)] ++;
+	}
+	R.time = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count()/Nsamples;
+	R.tries = double(SamplerStat::total_nd)/SamplerStat::count_nd;
+	R.overflows = SamplerStat::overflow_nd;
+	return R;
+}
+
+// chi^2 per bin of two histograms of the same number of events
+double chi2(const std::vector<double> & a, const std::vector<double> & b){
+	double sum = 0.;
+	size_t nbins = 0;
+	for (size_t i=0; i<a.size(); ++i){
+		if (a[i]+b[i] <= 0.) continue;
+		sum += std::pow(a[i]-b[i], 2)/(a[i]+b[i]);
+		nbins ++;
+	}
+	return nbins ? sum/nbins : 0.;
+}
+
+int main(int argc, char* argv[]){
+	int Nsamples = 20000;
+	if (argc==1){
+		std::cout << "Please tell the program whether use old table (if exists)," << std::endl;
+		std::cout << "and optionally the number of samples per case." << std::endl;
+		std::cout << "   $>./example5 new [N]" << std::endl;
+		std::cout << "Or $>./example5 old [N]" << std::endl;
+		return 1;
+	}
+	std::string mode = argv[1];
+	if (argc > 2) Nsamples = std::stoi(argv[2]);
+	std::string fname = "table23.h5";
+	boost::property_tree::ptree config;
+	std::ifstream input("./settings.xml");
+	read_xml(input, config);
+	config.put("Boltzmann.cq2cqg.<xmlattr>.vegas", 8);
+	write_xml("./settings23.xml", config);
+	initialize_mD_and_scale(1, 1.0);
+	Xsection23 vegas("Boltzmann/cq2cqg", "./settings23.xml", M2_Qq2Qqg);
+	if (mode != "old" || !vegas.load(fname)) vegas.init(fname);
+	Xsection23 box("Boltzmann/cq2cqg", "./settings.xml", M2_Qq2Qqg);
+	if (!box.load(fname)){
+		LOG_ERROR << "cannot read the cross-section from " << fname;
+		return 1;
+	}
+
+	double cases[3][3] = {{5., 0.2, 1.}, {10., 0.3, 5.}, {20., 0.4, 2.}};
+	bool pass = true;
+	for (auto & c : cases){
+		double sqrts = c[0], T = c[1], delta_t = c[2];
+		auto U = run(box, sqrts, T, delta_t, Nsamples);
+		auto V = run(vegas, sqrts, T, delta_t, Nsamples);
+		LOG_INFO << "sqrts = " << sqrts << ", T = " << T << ", delta_t = " << delta_t;
+		LOG_INFO << "  box:   " << U.tries << " tries, " << U.time << " s per sample";
+		LOG_INFO << "  VEGAS: " << V.tries << " tries, " << V.time << " s per sample, "
+				 << V.overflows << " points above the bound";
+		double cQ = chi2(U.hQ, V.hQ), ck = chi2(U.hk, V.hk);
+		LOG_INFO << "  chi2 per bin, E_Q: " << cQ << ", E_k: " << ck
+				 << " (about 1 if they agree)";
+		if (cQ > chi2_max || ck > chi2_max){
+			LOG_ERROR << "  the VEGAS proposal does not agree with the box";
+			pass = false;
+		}
+	}
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <fstream>
+#include <boost/property_tree/xml_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "simpleLogger.h"
+#include "workflow.h"
+#include "Xsection.h"
+#include "matrix_elements.h"
+#include "random.h"
+
+// This sample program checks the inverse-CDF samplers of Qq->Qq against the
+// rejection ones. At a few (E, T) it samples the rate with each, and
+// compares the distributions of x = log(1+E2/T) and cos(theta) of the
+// medium parton, recovered from the final momenta; at a few (sqrts, T) it
+// samples the cross-section with each, and compares the distributions of
+// w = -log(1-t/T^2), divided by its lowest value. Each is compared bin by
+// bin with a two-sample chi^2 per bin; it returns 1 if one is above
+// chi2_max.
+// The program runs on two copies of the settings: settings22.xml, with
+// the moments off, as only the sampling is checked, and settings22icdf.xml,
+// with icdf="64" on cq2cq as well. The tables go to table22.h5, which the
+// rejection samplers read, leaving the inverse CDFs out.
+
+typedef Xsection<2, double(*)(const double, void*)> Xsection22;
+
+const size_t Nbins = 20;
+const double chi2_max = 2.;
+
+// chi^2 per bin of two histograms of the same number of events
+double chi2(const std::vector<double> & a, const std::vector<double> & b){
+	double sum = 0.;
+	size_t nbins = 0;
+	for (size_t i=0; i<a.size(); ++i){
+		if (a[i]+b[i] <= 0.) continue;
+		sum += std::pow(a[i]-b[i], 2)/(a[i]+b[i]);
+		nbins ++;
+	}
+	return nbins ? sum/nbins : 0.;
+}
+
+void fill(std::vector<double> & h, double u){
+	if (u < 0. || u > 1.) return;
+	h[std::min(size_t(u*Nbins), Nbins-1)] ++;
+}
+
+// histograms of x/3 and (1+cos(theta))/2 of the rate at (E, T)
+std::vector<std::vector<double>> run(Rate22 & rate, double E, double T,
+			double M, int Nevents){
+	Srandom::set_seed(1);
+	std::vector<std::vector<double>> h(2, std::vector<double>(Nbins, 0.));
+	double v1 = std::sqrt(1. - std::pow(M/E, 2));
+	std::vector<fourvec> FS;
+	for (int n=0; n<Nevents; ++n){
+		rate.sample({E, T}, FS);
+		if (FS.size() < 2) continue;
+		// the final momenta add up to those of the heavy quark, along z,
+		// and of the medium parton
+		fourvec P = FS[0] + FS[1];
+		double E2 = P.t() - E;
+		if (E2 <= 0.) continue;
+		fill(h[0], std::log(1. + E2/T)/3.);
+		fill(h[1], (1. + (P.z() - v1*E)/E2)/2.);
+	}
+	return h;
+}
+
+// histogram of w/wmin of the cross-section at (sqrts, T)
+std::vector<double> run(Xsection22 & X, double sqrts, double T,
+			double M, int Nevents){
+	Srandom::set_seed(1);
+	std::vector<double> h(Nbins, 0.);
+	double s = sqrts*sqrts;
+	double p = (s-M*M)/2./sqrts;
+	double tmin = -std::pow(s-M*M, 2)/s;
+	double wmin = -std::log(1.-tmin/T/T);
+	std::vector<fourvec> FS;
+	for (int n=0; n<Nevents; ++n){
+		X.sample({sqrts, T}, FS);
+		// the heavy quark comes in along z, with momentum p
+		double t = 2.*(FS[0].z() - p)*p;
+		fill(h, -std::log(1.-t/T/T)/wmin);
+	}
+	return h;
+}
+
+int main(int argc, char* argv[]){
+	int Nevents = 20000;
+	if (argc==1){
+		std::cout << "Please tell the program whether use old table (if exists)," << std::endl;
+		std::cout << "and optionally the number of events per case." << std::endl;
+		std::cout << "   $>./example6 new [N]" << std::endl;
+		std::cout << "Or $>./example6 old [N]" << std::endl;
+		return 1;
+	}
+	std::string mode = argv[1];
+	if (argc > 2) Nevents = std::stoi(argv[2]);
+	std::string fname = "table22.h5";
+	boost::property_tree::ptree config;
+	std::ifstream input("./settings.xml");
+	read_xml(input, config);
+	double M = config.get<double>("Boltzmann.cq2cq.mass");
+	config.put("Boltzmann.cq2cq.<xmlattr>.moments", "off");
+	write_xml("./settings22.xml", config);
+	config.put("Boltzmann.cq2cq.<xmlattr>.icdf", 64);
+	write_xml("./settings22icdf.xml", config);
+	initialize_mD_and_scale(1, 1.0);
+	Rate22 icdf("Boltzmann/cq2cq", "./settings22icdf.xml", dX_Qq2Qq_dt);
+	if (mode != "old" || !icdf.loadX(fname)) icdf.initX(fname);
+	if (mode != "old" || !icdf.load(fname)) icdf.init(fname);
+	Rate22 rejection("Boltzmann/cq2cq", "./settings22.xml", dX_Qq2Qq_dt);
+	Xsection22 Xicdf("Boltzmann/cq2cq", "./settings22icdf.xml", dX_Qq2Qq_dt),
+			   Xrejection("Boltzmann/cq2cq", "./settings22.xml", dX_Qq2Qq_dt);
+	if (!rejection.loadX(fname) || !rejection.load(fname)
+		|| !Xicdf.load(fname) || !Xrejection.load(fname)){
+		LOG_ERROR << "cannot read the tables from " << fname;
+		return 1;
+	}
+
+	bool pass = true;
+	double rcases[3][2] = {{5., 0.2}, {10., 0.3}, {30., 0.5}};
+	for (auto & c : rcases){
+		double E = c[0], T = c[1];
+		auto I = run(icdf, E, T, M, Nevents);
+		auto R = run(rejection, E, T, M, Nevents);
+		double cx = chi2(I[0], R[0]), cc = chi2(I[1], R[1]);
+		LOG_INFO << "rate, E = " << E << ", T = " << T
+				 << ": chi2 per bin, x: " << cx << ", cos(theta): " << cc
+				 << " (about 1 if they agree)";
+		if (cx > chi2_max || cc > chi2_max){
+			LOG_ERROR << "  the inverse CDFs do not agree with the rejection";
+			pass = false;
+		}
+	}
+	double xcases[3][2] = {{3., 0.2}, {6., 0.3}, {15., 0.5}};
+	for (auto & c : xcases){
+		double sqrts = c[0], T = c[1];
+		double ct = chi2(run(Xicdf, sqrts, T, M, Nevents),
+						 run(Xrejection, sqrts, T, M, Nevents));
+		LOG_INFO << "cross-section, sqrts = " << sqrts << ", T = " << T
+				 << ": chi2 per bin, w: " << ct << " (about 1 if they agree)";
+		if (ct > chi2_max){
+			LOG_ERROR << "  the inverse CDF does not agree with the rejection";
+			pass = false;
+		}
+	}
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,465 @@
+#include "Evolver.h"
+#include <atomic>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+#include "Langevin.h"
+#include "random.h"
+#include "simpleLogger.h"
+
+const double fmc_to_GeV_m1 = 5.026;
+const double little_below_one = 1. - 1e-6;
+const double little_above_one = 1. + 1e-6;
+// freeze-out is located along a path to this fraction of a hydro step
+const double freezeout_resolution = 1e-2;
+
+// ensure |v| < 1
+void regulate_v(double * v){
+	double vabs2 = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+	if (vabs2 >= little_below_one*little_below_one){
+		double scale = 1.0/std::sqrt(vabs2)/little_above_one;
+		for (size_t i=0; i<3; ++i) v[i] *= scale;
+	}
+}
+
+Evolver::Evolver(double Tc, bool lgv, size_t nthreads, size_t chunk_size):
+_medium(nullptr), _lgv(lgv), _sorting(false), _stepping(substeps), _P_max(0.05),
+_max_substeps(100), _Tc(Tc),
+_nthreads(nthreads), _chunk_size(chunk_size), _nsteps(0)
+{
+	if (_nthreads == 0) _nthreads = std::thread::hardware_concurrency();
+	if (_nthreads == 0) _nthreads = 1;
+	if (_chunk_size == 0) _chunk_size = 1;
+	HQ_list[4] = ParticleStore();
+	HQ_list[5] = ParticleStore();
+}
+
+void Evolver::set_medium(const Medium * medium){
+	_medium = medium;
+}
+
+void Evolver::set_stepping(std::string mode){
+	if (mode == "substeps") _stepping = substeps;
+	else if (mode == "event") _stepping = event;
+	else if (mode == "adaptive") _stepping = adaptive;
+	else if (mode == "batched") _stepping = batched;
+	else {
+		LOG_FATAL << "stepping must be substeps, event, adaptive or batched, not "
+				  << mode;
+		exit(-1);
+	}
+	if (_stepping == event && _lgv) {
+		LOG_WARNING << "the Langevin update needs substeps, event stepping ignored";
+		_stepping = substeps;
+	}
+}
+
+void Evolver::set_adaptive(double P_max, size_t max_substeps){
+	_P_max = P_max;
+	_max_substeps = std::max(max_substeps, size_t(1));
+}
+
+void Evolver::set_sorting(bool sorting){
+	_sorting = sorting;
+}
+
+// interleaves the bits of ix and iy, so that nearby cells get nearby keys
+uint64_t morton(uint32_t ix, uint32_t iy){
+	auto spread = [](uint64_t v){
+		v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+		v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+		v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		v = (v | (v << 2)) & 0x3333333333333333ull;
+		v = (v | (v << 1)) & 0x5555555555555555ull;
+		return v;
+	};
+	return spread(ix) | (spread(iy) << 1);
+}
+
+// Morton key of the cell in the upper bits, energy bin in the lower 16,
+// cells off the grid after all others
+uint64_t Evolver::sort_key(const particle_ref & p){
+	size_t ix, iy;
+	uint64_t cell = _medium->cell(p.x, ix, iy) ?
+					morton(ix, iy) : 0xFFFFFFFFull << 16;
+	return (cell << 16) | std::min(energy_bin(p.pid, p.p.t()), size_t(0xFFFF));
+}
+
+void Evolver::sort_particles(void){
+	std::vector<std::pair<uint64_t, size_t>> keys;
+	std::vector<size_t> order;
+	for (auto & it : HQ_list){
+		auto & plist = it.second;
+		// only the live particles, the frozen ones stay behind them
+		keys.clear();
+		keys.reserve(plist.nactive);
+		for (size_t i=0; i<plist.nactive; ++i)
+			keys.push_back(std::make_pair(sort_key(plist[i]), i));
+		// ties keep their order, so the order only depends on the particles
+		std::sort(keys.begin(), keys.end());
+		order.resize(plist.size());
+		for (size_t i=0; i<keys.size(); ++i) order[i] = keys[i].second;
+		for (size_t i=keys.size(); i<plist.size(); ++i) order[i] = i;
+		plist.permute(order);
+	}
+}
+
+void freeze(particle_ref p, double T, const double * vcell){
+	p.freezeout = true;
+	p.Tf = T;
+	std::copy(vcell, vcell+3, p.vcell);
+}
+
+// times since the last radiation and absorption of p, in GeV^-1
+void formation_times(const particle_ref & p, double & D23, double & D32){
+	D23 = (p.x.t() - p.t_rad)*fmc_to_GeV_m1;
+	D32 = (p.x.t() - p.t_absorb)*fmc_to_GeV_m1;
+}
+
+void take_final_state(particle_ref p, int channel, const FinalStates & FS){
+	if (channel >= 0) p.p = FS.p[0];
+	if (channel == 2 || channel == 3) p.t_rad = p.x.t();
+	if (channel == 4 || channel == 5) p.t_absorb = p.x.t();
+}
+
+double Evolver::lab_time(const particle_ref & p, double tau_now, double dtau){
+	if (!_medium->dynamic()) return dtau;
+	double vz = p.p.z()/p.p.t();
+	double t_m_zvz = p.x.t() - p.x.z()*vz;
+	double one_m_vz2 = 1. - vz*vz;
+	double dtau2 = dtau*(dtau+2*tau_now);
+	return (std::sqrt(t_m_zvz*t_m_zvz+one_m_vz2*dtau2) - t_m_zvz)/one_m_vz2;
+}
+
+void Evolver::HQ_step(particle_ref p, double tau_now, double dtau,
+					double T, const double * vcell, UpdateScratch & scratch){
+	// below Tc, the particle freezes out
+	if (T <= _Tc){
+		freeze(p, T, vcell);
+		return;
+	}
+	// lab time needed to reach the next proper time step
+	double dt_lab = lab_time(p, tau_now, dtau);
+	// time should be in GeV^-1 in the update function
+	double D23, D32;
+	formation_times(p, D23, D32);
+	FinalStates FS;
+	int channel = update_particle_momentum(dt_lab*fmc_to_GeV_m1, T, vcell, p.pid,
+				D23, D32, p.p, scratch, FS);
+	advance(p, dt_lab, T, vcell, channel, FS);
+}
+
+void Evolver::advance(particle_ref p, double dt_lab, double T,
+					const double * vcell, int channel, const FinalStates & FS){
+	p.freestream(dt_lab);
+	take_final_state(p, channel, FS);
+	// additional Langevin modification to the momentum after LBT
+	if (_lgv){
+		fourvec pOut;
+		Ito_update(dt_lab*fmc_to_GeV_m1, p.mass, T, vcell, p.p, pOut);
+		p.p = pOut;
+	}
+}
+
+void Evolver::evolve(particle_ref p, int nsubsteps, UpdateScratch & scratch){
+	double dtau = _medium->dtau()/nsubsteps;
+	double T, tau_now;
+	double vcell[3];
+	for (int i=0; i<nsubsteps; ++i){
+		if (p.freezeout) return;
+		if (_medium->dynamic())
+			tau_now = std::sqrt(p.x.t()*p.x.t() - p.x.z()*p.x.z());
+		else
+			tau_now = p.x.t();
+		_medium->interpolate(tau_now, p.x, T, vcell);
+		regulate_v(vcell);
+		HQ_step(p, tau_now, dtau, T, vcell, scratch);
+	}
+}
+
+// The total rate per lab time is the cell frame rate times E_cell/E.
+// With the cell velocity (w*sqrt(1-vz^2), vz), vz = z/t, that ratio is at
+// most (g(vz) + w*pT/E)/sqrt(1-w^2), with g(vz) = (1-vz*pz/E)/sqrt(1-vz^2)
+// convex in the rapidity of vz, hence the largest at one end of the path.
+double Evolver::max_rate(const particle_ref & p, double dt_lab){
+	double E = p.p.t();
+	double Tmax, ratio;
+	if (!_medium->dynamic()){
+		double v[3];
+		_medium->interpolate(p.x.t(), p.x, Tmax, v);
+		regulate_v(v);
+		ratio = p.p.boost_to(v[0], v[1], v[2]).t()/E;
+	}
+	else{
+		double a = dt_lab/E;
+		fourvec x1{p.x.t() + dt_lab, p.x.x() + p.p.x()*a,
+				   p.x.y() + p.p.y()*a, p.x.z() + p.p.z()*a};
+		double w;
+		_medium->bounds(p.x, x1, Tmax, w);
+		w = std::min(w, little_below_one);
+		double uz = p.p.z()/E,
+			   uT = std::sqrt(p.p.x()*p.p.x() + p.p.y()*p.p.y())/E;
+		auto g = [uz](double vz){return (1.-vz*uz)/std::sqrt(1.-vz*vz);};
+		ratio = (std::max(g(p.x.z()/p.x.t()), g(x1.z()/x1.t())) + w*uT)
+				/std::sqrt(1.-w*w);
+	}
+	return max_total_rate(p.pid, ratio*E, Tmax)*ratio*fmc_to_GeV_m1;
+}
+
+// Left to right, each piece of the path is skipped if T stays above Tc over
+// it, and halved if it may cross; a short piece that may cross is decided
+// by T at its end.
+double Evolver::freezeout_time(const particle_ref & p, double dt_lab){
+	auto at = [&p](double dt){
+		double a = dt/p.p.t();
+		return fourvec{p.x.t() + dt, p.x.x() + p.p.x()*a,
+					   p.x.y() + p.p.y()*a, p.x.z() + p.p.z()*a};
+	};
+	double resolution = freezeout_resolution*_medium->dtau();
+	double a = 0., h = dt_lab;
+	while (a < dt_lab){
+		double b = std::min(a + h, dt_lab);
+		fourvec xb = at(b);
+		double Tmin, Tmax, vmax;
+		_medium->bounds(at(a), xb, Tmin, Tmax, vmax);
+		if (Tmax <= _Tc) return a;
+		if (Tmin <= _Tc){
+			if (b - a > resolution){
+				h = .5*(b - a);
+				continue;
+			}
+			double T, v[3];
+			_medium->interpolate(_medium->dynamic() ?
+					std::sqrt(xb.t()*xb.t() - xb.z()*xb.z()) : xb.t(), xb, T, v);
+			if (T <= _Tc) return b;
+		}
+		// above Tc up to b, longer pieces next
+		a = b;
+		h *= 2.;
+	}
+	return dt_lab;
+}
+
+void Evolver::evolve_events(particle_ref p, UpdateScratch & scratch){
+	if (p.freezeout) return;
+	auto tau = [this](const particle_ref & p){
+		return _medium->dynamic() ? std::sqrt(p.x.t()*p.x.t() - p.x.z()*p.x.z()) : p.x.t();
+	};
+	double T, vcell[3];
+	double tau_now = tau(p), tau_end = tau_now + _medium->dtau();
+	_medium->interpolate(tau_now, p.x, T, vcell);
+	regulate_v(vcell);
+	if (T <= _Tc){
+		freeze(p, T, vcell);
+		return;
+	}
+	// a scattering changes the momentum, so the path, its bound and where
+	// it crosses Tc
+	while (true){
+		double dt_left = lab_time(p, tau_now, tau_end - tau_now);
+		// the path ends where the particle freezes out, if before dt_left
+		double dt_path = freezeout_time(p, dt_left);
+		double bound = max_rate(p, dt_path);
+		int channel = -1;
+		while (channel < 0){
+			double wait = dt_path;
+			if (bound > 0.)
+				wait = -std::log(1.-Srandom::init_dis(Srandom::gen))/bound;
+			if (wait >= dt_path){
+				p.freestream(dt_path);
+				if (dt_path < dt_left){
+					_medium->interpolate(tau(p), p.x, T, vcell);
+					regulate_v(vcell);
+					freeze(p, T, vcell);
+				}
+				return;
+			}
+			p.freestream(wait);
+			dt_path -= wait;
+			dt_left -= wait;
+			tau_now = tau(p);
+			_medium->interpolate(tau_now, p.x, T, vcell);
+			regulate_v(vcell);
+			if (T <= _Tc){
+				freeze(p, T, vcell);
+				return;
+			}
+			double D23, D32;
+			formation_times(p, D23, D32);
+			double rate = total_rate(T, vcell, p.pid, D23, D32, p.p)*fmc_to_GeV_m1;
+			if (rate > bound)
+				LOG_WARNING << "rate = " << rate << " above its bound " << bound;
+			if (Srandom::init_dis(Srandom::gen)*bound >= rate) continue;
+			FinalStates FS;
+			channel = scatter(T, vcell, p.pid, D23, D32, p.p, scratch, FS);
+			take_final_state(p, channel, FS);
+		}
+	}
+}
+
+void Evolver::evolve_adaptive(particle_ref p, UpdateScratch & scratch){
+	auto tau = [this](const particle_ref & p){
+		return _medium->dynamic() ? std::sqrt(p.x.t()*p.x.t() - p.x.z()*p.x.z()) : p.x.t();
+	};
+	double T, vcell[3];
+	double tau_now = tau(p), tau_end = tau_now + _medium->dtau();
+	double dtau_min = _medium->dtau()/_max_substeps;
+	// the last substep may end a little short of tau_end by rounding
+	while (!p.freezeout && tau_end - tau_now > 1e-6*dtau_min){
+		_medium->interpolate(tau_now, p.x, T, vcell);
+		regulate_v(vcell);
+		if (T <= _Tc){
+			freeze(p, T, vcell);
+			return;
+		}
+		double D23, D32;
+		formation_times(p, D23, D32);
+		// rate per lab time in fm^-1
+		double rate = total_rate(T, vcell, p.pid, D23, D32, p.p)*fmc_to_GeV_m1;
+		double dt_lab = lab_time(p, tau_now, tau_end - tau_now);
+		if (rate*dt_lab > _P_max)
+			dt_lab = std::max(_P_max/rate,
+						lab_time(p, tau_now, std::min(dtau_min, tau_end - tau_now)));
+		// the substep ends where the particle freezes out, if before
+		double dt_free = freezeout_time(p, dt_lab);
+		bool freezes = (dt_free < dt_lab);
+		if (freezes) dt_lab = dt_free;
+		double P = rate*dt_lab;
+		if (P > 0.15) LOG_WARNING << "P_total = " << P << " may be too large";
+		FinalStates FS;
+		int channel = -1;
+		if (Srandom::init_dis(Srandom::gen) < P)
+			channel = scatter(T, vcell, p.pid, D23, D32, p.p, scratch, FS);
+		advance(p, dt_lab, T, vcell, channel, FS);
+		tau_now = tau(p);
+		if (freezes){
+			_medium->interpolate(tau_now, p.x, T, vcell);
+			regulate_v(vcell);
+			freeze(p, T, vcell);
+		}
+	}
+}
+
+void Evolver::run_chunks(size_t nchunks, unsigned substream0,
+				const std::function<void(size_t, UpdateScratch &)> & code){
+	std::atomic<size_t> next(0);
+	unsigned stream = _nsteps;
+	auto work = [&code, &next, nchunks, stream, substream0](){
+		UpdateScratch scratch;
+		size_t c;
+		while ( (c = next++) < nchunks ){
+			Srandom::set_stream(stream, substream0 + c);
+			code(c, scratch);
+		}
+	};
+	size_t nthreads = std::min(_nthreads, nchunks);
+	std::vector<std::thread> threads;
+	for (size_t i=0; i<nthreads; ++i) threads.push_back( std::thread(work) );
+	for (auto & t : threads) t.join();
+}
+
+void Evolver::decide(item & I, double dtau){
+	auto p = (*I.plist)[I.i];
+	I.active = false;
+	I.scatters = false;
+	I.channel = -1;
+	if (p.freezeout) return;
+	double tau_now = _medium->dynamic() ?
+				std::sqrt(p.x.t()*p.x.t() - p.x.z()*p.x.z()) : p.x.t();
+	_medium->interpolate(tau_now, p.x, I.T, I.vcell);
+	regulate_v(I.vcell);
+	// below Tc, the particle freezes out
+	if (I.T <= _Tc){
+		freeze(p, I.T, I.vcell);
+		return;
+	}
+	I.active = true;
+	I.dt_lab = lab_time(p, tau_now, dtau);
+	double D23, D32;
+	formation_times(p, D23, D32);
+	double P = scattering_probability(I.dt_lab*fmc_to_GeV_m1, I.T, I.vcell,
+									  p.pid, D23, D32, p.p);
+	if (Srandom::init_dis(Srandom::gen) > P) return;
+	I.scatters = choose_channel(I.T, I.vcell, p.pid, D23, D32, p.p, I.s);
+}
+
+void Evolver::step_batched(int nsubsteps){
+	_items.clear();
+	for (auto & it : HQ_list)
+		for (size_t i=0; i<it.second.nactive; ++i){
+			_items.push_back(item());
+			_items.back().plist = &it.second;
+			_items.back().i = i;
+		}
+	size_t n = _items.size(), nchunks = (n + _chunk_size - 1)/_chunk_size;
+	double dtau = _medium->dtau()/nsubsteps;
+	auto group = [this](size_t a, size_t b){
+		const Scattering & A = _items[a].s, & B = _items[b].s;
+		return std::make_pair(std::abs(A.pid), A.slot)
+			 < std::make_pair(std::abs(B.pid), B.slot);
+	};
+	for (int k=0; k<nsubsteps; ++k){
+		// each pass of each substep has its own substreams
+		unsigned substream0 = 1 + 3*k*nchunks;
+		run_chunks(nchunks, substream0, [this, n, dtau](size_t c, UpdateScratch &){
+			for (size_t j=c*_chunk_size; j<std::min(n, (c+1)*_chunk_size); ++j)
+				decide(_items[j], dtau);
+		});
+		_scattering.clear();
+		for (size_t j=0; j<n; ++j)
+			if (_items[j].scatters) _scattering.push_back(j);
+		std::stable_sort(_scattering.begin(), _scattering.end(), group);
+		size_t m = _scattering.size(), mchunks = (m + _chunk_size - 1)/_chunk_size;
+		run_chunks(mchunks, substream0 + nchunks,
+				[this, m](size_t c, UpdateScratch & scratch){
+			for (size_t j=c*_chunk_size; j<std::min(m, (c+1)*_chunk_size); ++j){
+				auto & I = _items[_scattering[j]];
+				I.channel = sample_channel_local(I.s, scratch, I.FS);
+			}
+		});
+		run_chunks(nchunks, substream0 + 2*nchunks,
+				[this, n](size_t c, UpdateScratch &){
+			for (size_t j=c*_chunk_size; j<std::min(n, (c+1)*_chunk_size); ++j){
+				auto & I = _items[j];
+				if (!I.active) continue;
+				if (I.channel >= 0) to_lab(I.s, I.FS);
+				advance((*I.plist)[I.i], I.dt_lab, I.T, I.vcell, I.channel, I.FS);
+			}
+		});
+	}
+}
+
+void Evolver::step(int nsubsteps){
+	if (_medium == nullptr){
+		LOG_FATAL << "no medium to evolve the heavy quarks in";
+		exit(-1);
+	}
+	if (_sorting) sort_particles();
+	if (_stepping == batched) step_batched(nsubsteps);
+	else {
+		struct chunk{
+			ParticleStore * plist;
+			size_t start, end;
+		};
+		std::vector<chunk> chunks;
+		for (auto & it : HQ_list){
+			auto & plist = it.second;
+			for (size_t i=0; i<plist.nactive; i+=_chunk_size)
+				chunks.push_back(chunk{&plist, i,
+									std::min(i+_chunk_size, plist.nactive)});
+		}
+		run_chunks(chunks.size(), 1,
+				[this, &chunks, nsubsteps](size_t c, UpdateScratch & scratch){
+			auto & plist = *chunks[c].plist;
+			for (size_t i=chunks[c].start; i<chunks[c].end; ++i)
+				switch (_stepping){
+					case event: evolve_events(plist[i], scratch); break;
+					case adaptive: evolve_adaptive(plist[i], scratch); break;
+					default: evolve(plist[i], nsubsteps, scratch); break;
+				}
+		});
+	}
+	// the next steps only go through the particles still live
+	for (auto & it : HQ_list) it.second.compact();
+	_nsteps ++;
+}
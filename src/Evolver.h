@@ -0,0 +1,107 @@
+#ifndef EVOLVER_H
+#define EVOLVER_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include "workflow.h"
+#include "ParticleStore.h"
+#include "Medium.h"
+
+// Evolves the heavy quark list through a hydro step of the medium natively.
+// Only the live particles of each species are stepped: those that froze
+// out in a step are moved behind them at its end.
+// The particles are cut into chunks of fixed size, and each worker thread
+// keeps grabbing the next unprocessed chunk until none is left.
+// Chunk c of the n-th step always samples from random substream (n, c+1),
+// so results only depend on the seed, not on the threads or scheduling.
+// In "substeps" stepping, each hydro step is cut into fixed substeps with
+// one trial of scattering each. In "event" stepping, the time to the next
+// scattering is sampled from a bound of the total rate along the path of
+// the particle over the hydro step, and each candidate is kept with the
+// ratio of the actual rate to the bound (thinning), so the rates are only
+// looked up at the candidates.
+// Freeze-out is found where the path first crosses Tc, not only at the
+// candidates.
+// With sorting on, each step starts by ordering the particles of each
+// species by hydro cell along a Morton curve, then by energy bin, so that
+// the particles of a chunk look up nearby cells of the frames and nearby
+// points of the rate tables.
+// In "adaptive" stepping, each particle takes the largest substeps whose
+// probability of scattering stays below P_max, at least dtau/max_substeps
+// and at most what is left of the hydro step: many substeps where the rate
+// is high, a single one in the cold and dilute medium. A substep that
+// crosses Tc ends there, and the particle freezes out.
+// "batched" stepping takes the same substeps as "substeps", each in three
+// passes over all live particles: decide whether and in which channel each
+// scatters, sample the scatterings grouped by species and channel, so that
+// one sampler and its tables run over a whole group, then rotate and
+// boost the final states to the lab frame, apply them and stream all the
+// particles.
+class Evolver{
+private:
+	enum stepping_mode {substeps, event, adaptive, batched};
+	const Medium * _medium;
+	bool _lgv, _sorting;
+	stepping_mode _stepping;
+	double _P_max;
+	size_t _max_substeps;
+	double _Tc;
+	size_t _nthreads, _chunk_size;
+	unsigned _nsteps;
+	// one live particle through the passes of a batched substep
+	struct item{
+		ParticleStore * plist;
+		size_t i;
+		bool active, scatters;
+		double T, vcell[3], dt_lab;
+		Scattering s;
+		int channel;
+		FinalStates FS;
+	};
+	std::vector<item> _items;
+	// the items that scatter, grouped by species and channel
+	std::vector<size_t> _scattering;
+	// runs code(c, scratch) for c < nchunks on the worker threads, chunk c
+	// sampling from random substream (step, substream0 + c)
+	void run_chunks(size_t nchunks, unsigned substream0,
+				const std::function<void(size_t, UpdateScratch &)> & code);
+	void decide(item & I, double dtau);
+	void step_batched(int nsubsteps);
+	uint64_t sort_key(const particle_ref & p);
+	void sort_particles(void);
+	void evolve(particle_ref p, int nsubsteps, UpdateScratch & scratch);
+	void HQ_step(particle_ref p, double tau_now, double dtau,
+				double T, const double * vcell, UpdateScratch & scratch);
+	// streams p by dt_lab and applies the scattering channel, if any
+	void advance(particle_ref p, double dt_lab, double T, const double * vcell,
+				int channel, const FinalStates & FS);
+	void evolve_adaptive(particle_ref p, UpdateScratch & scratch);
+	// lab time to advance p by dtau in proper time
+	double lab_time(const particle_ref & p, double tau_now, double dtau);
+	// bound of the total rate per lab time [fm^-1] of p along the path
+	double max_rate(const particle_ref & p, double dt_lab);
+	// lab time along the path of p within dt_lab at which T first drops
+	// to Tc, to within freezeout_resolution of a hydro step, dt_lab if it
+	// stays above
+	double freezeout_time(const particle_ref & p, double dt_lab);
+	void evolve_events(particle_ref p, UpdateScratch & scratch);
+public:
+	std::map<int, ParticleStore> HQ_list;
+	// nthreads = 0 uses all hardware threads
+	Evolver(double Tc, bool lgv, size_t nthreads=0, size_t chunk_size=64);
+	// the medium is not owned, and must outlive the steps
+	void set_medium(const Medium * medium);
+	// "substeps" (default), "event", "adaptive" or "batched";
+	// the Langevin update does not go with "event"
+	void set_stepping(std::string mode);
+	void set_adaptive(double P_max, size_t max_substeps);
+	// sort the particles at the start of each step, off by default
+	void set_sorting(bool sorting);
+	// advance all particles by one hydro step in nsubsteps substeps
+	void step(int nsubsteps);
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "FrameStream.h"
+#include "TableBase.h"
+#include "H5Cpp.h"
+#include "simpleLogger.h"
+
+FrameStream::FrameStream(std::string fname):
+_file(new H5::H5File), _ncells(0), _window(npos), _pending(npos),
+_pending_ok(false)
+{
+	std::lock_guard<std::mutex> guard(hdf5_lock);
+	H5::Exception::dontPrint();
+	try{
+		_file->openFile(fname, H5F_ACC_RDONLY);
+		// in name order, as h5py lists them
+		H5::Group event = _file->openGroup("/Event");
+		for (hsize_t i=0; i<event.getNumObjs(); ++i)
+			_steps.push_back(event.getObjnameByIdx(i));
+	}catch (H5::Exception &) {
+		LOG_FATAL << "cannot read the hydro history in " << fname;
+		exit(-1);
+	}
+	LOG_INFO << _steps.size() << " hydro frames in " << fname;
+}
+
+FrameStream::~FrameStream(){
+	if (_io.joinable()) _io.join();
+	std::lock_guard<std::mutex> guard(hdf5_lock);
+	_file->close();
+}
+
+bool FrameStream::read(size_t index, std::vector<double> & cells){
+	cells.resize(3*_ncells);
+	std::lock_guard<std::mutex> guard(hdf5_lock);
+	H5::Exception::dontPrint();
+	try{
+		H5::Group group = _file->openGroup("/Event/"+_steps[index]);
+		// field f goes straight into every 3rd double from f
+		hsize_t length = cells.size(), count = _ncells, stride = 3;
+		H5::DataSpace memspace(1, &length);
+		const char * fields[3] = {"Temp", "Vx", "Vy"};
+		for (hsize_t f=0; f<3; ++f){
+			H5::DataSet dataset = group.openDataSet(fields[f]);
+			H5::DataSpace filespace = dataset.getSpace();
+			if (filespace.getSimpleExtentNpoints() != count){
+				LOG_WARNING << fields[f] << " of " << _steps[index]
+							<< " does not match the grid";
+				return false;
+			}
+			memspace.selectHyperslab(H5S_SELECT_SET, &count, &f, &stride);
+			dataset.read(cells.data(), H5::PredType::NATIVE_DOUBLE,
+						 memspace, filespace);
+		}
+	}catch (H5::Exception &) {
+		LOG_WARNING << "cannot read hydro frame " << _steps[index];
+		return false;
+	}
+	return true;
+}
+
+void FrameStream::prefetch(size_t index){
+	if (index >= _steps.size()) return;
+	_pending = index;
+	_io = std::thread([this, index](){
+		_pending_ok = read(index, _buffer);
+	});
+}
+
+bool FrameStream::wait(size_t index){
+	if (_io.joinable()) _io.join();
+	bool ok = _pending == index && _pending_ok;
+	_pending = npos;
+	return ok;
+}
+
+void FrameStream::load(Medium & medium, size_t index){
+	if (index+1 >= _steps.size()){
+		LOG_FATAL << "no hydro frames " << index << " and " << index+1;
+		exit(-1);
+	}
+	_ncells = medium.ncells();
+	if (_window != npos && index == _window+1){
+		// the later frame stays, the next one has been read meanwhile
+		medium.shift_frames();
+		if (!wait(index+1) && !read(index+1, _buffer)){
+			LOG_FATAL << "cannot load hydro frame " << index+1;
+			exit(-1);
+		}
+		medium.set_frame(1, _buffer);
+	}
+	else{
+		wait(npos);
+		for (size_t k=0; k<2; ++k){
+			if (!read(index+k, _buffer)){
+				LOG_FATAL << "cannot load hydro frame " << index+k;
+				exit(-1);
+			}
+			medium.set_frame(k, _buffer);
+		}
+	}
+	_window = index;
+	// _buffer now holds a frame the medium no longer needs
+	prefetch(index+2);
+}
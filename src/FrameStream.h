@@ -0,0 +1,44 @@
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include "Medium.h"
+
+namespace H5 { class H5File; }
+
+// Streams the frames of a hydro history file (Temp, Vx, Vy of the groups
+// in /Event) into a Medium. Moving the window of the medium by one step
+// keeps its later frame and only adds the new one, and the frame after the
+// window is read on a background thread while the particles evolve, so it
+// is usually ready by the next step.
+class FrameStream{
+private:
+	std::unique_ptr<H5::H5File> _file;
+	std::vector<std::string> _steps;
+	size_t _ncells;
+	// first frame in the medium, npos if none yet
+	size_t _window;
+	// frame read in the background into _buffer, npos if none
+	std::thread _io;
+	size_t _pending;
+	bool _pending_ok;
+	std::vector<double> _buffer;
+	// interleaved (T, vx, vy) cells of frame index
+	bool read(size_t index, std::vector<double> & cells);
+	void prefetch(size_t index);
+	// waits for the background read, true if it read index
+	bool wait(size_t index);
+public:
+	static const size_t npos = size_t(-1);
+	FrameStream(std::string fname);
+	~FrameStream();
+	size_t size(void) const {return _steps.size();}
+	// makes medium hold frames index and index+1, and starts reading the
+	// frame after them
+	void load(Medium & medium, size_t index);
+};
+
+#endif
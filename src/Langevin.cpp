@@ -69,6 +69,11 @@ void postpoint_update(	double dt, double M, double T, std::vector<double> v,
 
 void Ito_update(	double dt, double M, double T, std::vector<double> v, 
 						const fourvec & pIn, fourvec & pOut){
+	Ito_update(dt, M, T, v.data(), pIn, pOut);
+}
+
+void Ito_update(	double dt, double M, double T, const double * v, 
+						const fourvec & pIn, fourvec & pOut){
 	// Boost pIn to medium frame
 	auto pIn_cell = pIn.boost_to(v[0], v[1], v[2]);
 	// imaging rotating to a frame where pIn lies on z-axis
@@ -10,4 +10,6 @@ double kpara(double E, double M, double T);
 void initialize_transport_coeff(double A, double B);
 void postpoint_update( double dt, double M, double T, std::vector<double> v, const fourvec & pIn, fourvec & pOut);
 void Ito_update( double dt, double M, double T, std::vector<double> v, const fourvec & pIn, fourvec & pOut);
+// v points to the 3 components of the cell velocity
+void Ito_update( double dt, double M, double T, const double * v, const fourvec & pIn, fourvec & pOut);
 #endif
@@ -0,0 +1,145 @@
+#include "Medium.h"
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+Medium::Medium(bool dynamic):
+_dynamic(dynamic), _tnow(0.), _dtau(0.),
+_xmin(0.), _xmax(0.), _ymin(0.), _ymax(0.), _dx(0.), _dy(0.),
+_Nx(0), _Ny(0), _static{0., 0., 0., 0.}
+{
+}
+
+void Medium::set_grid(double xmin, double xmax, double ymin, double ymax,
+					double dx, double dy, size_t Nx, size_t Ny){
+	_xmin = xmin; _xmax = xmax;
+	_ymin = ymin; _ymax = ymax;
+	_dx = dx; _dy = dy;
+	_Nx = Nx; _Ny = Ny;
+	for (auto & F : _frames) F.assign(3*_Nx*_Ny, 0.);
+}
+
+void Medium::set_frame(size_t k, const double * T, const double * vx,
+					const double * vy){
+	double * F = _frames[k].data();
+	for (size_t n=0; n<_Nx*_Ny; ++n){
+		F[3*n] = T[n];
+		F[3*n+1] = vx[n];
+		F[3*n+2] = vy[n];
+	}
+}
+
+void Medium::set_frame(size_t k, std::vector<double> & cells){
+	_frames[k].swap(cells);
+}
+
+void Medium::shift_frames(void){
+	_frames[0].swap(_frames[1]);
+}
+
+void Medium::set_time(double tnow, double dtau){
+	_tnow = tnow;
+	_dtau = dtau;
+}
+
+void Medium::set_static(double dtau, double T, double vx, double vy, double vz){
+	_dtau = dtau;
+	_static[0] = T; _static[1] = vx; _static[2] = vy; _static[3] = vz;
+}
+
+void Medium::interpolate(double tau, const fourvec & x, double & T,
+					double * v) const{
+	if (!_dynamic){
+		T = _static[0];
+		for (size_t i=0; i<3; ++i) v[i] = _static[i+1];
+		return;
+	}
+	// outside the grid, the medium is vacuum
+	if (x.x() < _xmin || x.x() > _xmax || x.y() < _ymin || x.y() > _ymax
+		|| _Nx < 2 || _Ny < 2){
+		T = 0.;
+		v[0] = 0.; v[1] = 0.; v[2] = 0.;
+		return;
+	}
+	double rt = (tau - _tnow)/_dtau;
+	double nx = (x.x() - _xmin)/_dx, ny = (x.y() - _ymin)/_dy;
+	size_t ix = std::min(size_t(std::floor(nx)), _Nx-2),
+		   iy = std::min(size_t(std::floor(ny)), _Ny-2);
+	double rx = nx - ix, ry = ny - iy;
+	double result[3] = {0., 0., 0.};
+	for (size_t k=0; k<2; ++k)
+		for (size_t i=0; i<2; ++i){
+			// the two corners along y are next to each other
+			const double * c = _frames[k].data() + 3*((ix+i)*_Ny + iy);
+			double w = (k?rt:1.-rt)*(i?rx:1.-rx);
+			for (size_t f=0; f<3; ++f)
+				result[f] += w*((1.-ry)*c[f] + ry*c[3+f]);
+		}
+	double vz = x.z()/x.t();
+	double gamma = 1.0/std::sqrt(1.0-vz*vz);
+	T = result[0];
+	v[0] = result[1]/gamma;
+	v[1] = result[2]/gamma;
+	v[2] = vz;
+}
+
+void Medium::interpolate(size_t n, const double * tau, const double * x,
+					double * T, double * v) const{
+	for (size_t i=0; i<n; ++i){
+		const double * xi = x + 4*i;
+		interpolate(tau[i], fourvec{xi[0], xi[1], xi[2], xi[3]}, T[i], v+3*i);
+	}
+}
+
+bool Medium::cell(const fourvec & x, size_t & ix, size_t & iy) const{
+	ix = 0; iy = 0;
+	if (!_dynamic) return true;
+	if (x.x() < _xmin || x.x() > _xmax || x.y() < _ymin || x.y() > _ymax
+		|| _Nx < 2 || _Ny < 2) return false;
+	ix = std::min(size_t(std::floor((x.x() - _xmin)/_dx)), _Nx-2);
+	iy = std::min(size_t(std::floor((x.y() - _ymin)/_dy)), _Ny-2);
+	return true;
+}
+
+// The interpolation in x, y is a weighted mean over the corners of a cell,
+// and is linear in tau, so over the cells the path crosses and the tau at
+// its ends, the corner values bound it.
+void Medium::bounds(const fourvec & x0, const fourvec & x1,
+					double & Tmin, double & Tmax, double & vmax) const{
+	if (!_dynamic){
+		Tmin = _static[0];
+		Tmax = _static[0];
+		vmax = std::sqrt(_static[1]*_static[1] + _static[2]*_static[2]);
+		return;
+	}
+	Tmin = 0.; Tmax = 0.; vmax = 0.;
+	double xlo = std::min(x0.x(), x1.x()), xhi = std::max(x0.x(), x1.x()),
+		   ylo = std::min(x0.y(), x1.y()), yhi = std::max(x0.y(), x1.y());
+	// outside the grid, the medium is vacuum
+	if (xhi < _xmin || xlo > _xmax || yhi < _ymin || ylo > _ymax
+		|| _Nx < 2 || _Ny < 2) return;
+	// a path that leaves the grid reaches the vacuum
+	bool inside = (xlo >= _xmin && xhi <= _xmax && ylo >= _ymin && yhi <= _ymax);
+	if (inside) Tmin = std::numeric_limits<double>::max();
+	auto first = [](double x, double low, double d, size_t N){
+		return std::min(size_t(std::max(std::floor((x-low)/d), 0.)), N-2);
+	};
+	size_t ix0 = first(xlo, _xmin, _dx, _Nx), ix1 = first(xhi, _xmin, _dx, _Nx)+1,
+		   iy0 = first(ylo, _ymin, _dy, _Ny), iy1 = first(yhi, _ymin, _dy, _Ny)+1;
+	double rt[2] = {
+		(std::sqrt(x0.t()*x0.t() - x0.z()*x0.z()) - _tnow)/_dtau,
+		(std::sqrt(x1.t()*x1.t() - x1.z()*x1.z()) - _tnow)/_dtau};
+	for (size_t ix=ix0; ix<=ix1; ++ix)
+		for (size_t iy=iy0; iy<=iy1; ++iy){
+			const double * c0 = _frames[0].data() + 3*(ix*_Ny + iy),
+						 * c1 = _frames[1].data() + 3*(ix*_Ny + iy);
+			for (size_t k=0; k<2; ++k){
+				double T = (1.-rt[k])*c0[0] + rt[k]*c1[0],
+					   vx = (1.-rt[k])*c0[1] + rt[k]*c1[1],
+					   vy = (1.-rt[k])*c0[2] + rt[k]*c1[2];
+				Tmax = std::max(Tmax, T);
+				if (inside) Tmin = std::min(Tmin, T);
+				vmax = std::max(vmax, std::sqrt(vx*vx + vy*vy));
+			}
+		}
+}
@@ -0,0 +1,64 @@
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include <vector>
+#include "lorentz.h"
+
+// The medium the heavy quarks move through: either a static cell, or the
+// hydro history on a regular x-y grid, of which the two frames enclosing
+// the current step are kept. It is interpolated linearly in tau, x and y.
+// A frame is one contiguous array of cells, each holding (T, vx, vy) next
+// to each other, so that one pass over the 8 corners interpolates all the
+// fields. The cell velocity includes the Bjorken vz = z/t.
+class Medium{
+private:
+	bool _dynamic;
+	// current frame time, hydro step, grid
+	double _tnow, _dtau;
+	double _xmin, _xmax, _ymin, _ymax, _dx, _dy;
+	size_t _Nx, _Ny;
+	// field f of cell (ix, iy) of frame k at [k][(ix*_Ny+iy)*3+f]
+	std::vector<double> _frames[2];
+	// static medium: T, vx, vy, vz
+	double _static[4];
+public:
+	Medium(bool dynamic);
+	bool dynamic(void) const {return _dynamic;}
+	double tnow(void) const {return _tnow;}
+	double dtau(void) const {return _dtau;}
+	size_t ncells(void) const {return _Nx*_Ny;}
+	void set_grid(double xmin, double xmax, double ymin, double ymax,
+				double dx, double dy, size_t Nx, size_t Ny);
+	// fields of frame k = 0, 1 as row-major [ix][iy] arrays of Nx*Ny
+	void set_frame(size_t k, const double * T, const double * vx,
+				const double * vy);
+	// swaps in frame k already interleaved, cells gets the old frame back
+	void set_frame(size_t k, std::vector<double> & cells);
+	// frame 1 becomes frame 0, to move the window by one hydro step
+	void shift_frames(void);
+	// frame 0 is at tnow, frame 1 at tnow + dtau
+	void set_time(double tnow, double dtau);
+	void set_static(double dtau, double T, double vx, double vy, double vz);
+	// T and the 3 components of the cell velocity at (tau, x),
+	// vacuum outside the grid
+	void interpolate(double tau, const fourvec & x, double & T,
+				double * v) const;
+	// the same for n points: tau[i], x[4*i..4*i+3] = (t, x, y, z),
+	// T[i], v[3*i..3*i+2]
+	void interpolate(size_t n, const double * tau, const double * x,
+				double * T, double * v) const;
+	// cell (ix, iy) of the grid that holds x, false outside the grid;
+	// a static medium is a single cell
+	bool cell(const fourvec & x, size_t & ix, size_t & iy) const;
+	// bounds of T and of the transverse flow over the cells reached by a
+	// straight path from x0 to x1
+	void bounds(const fourvec & x0, const fourvec & x1,
+				double & Tmin, double & Tmax, double & vmax) const;
+	void bounds(const fourvec & x0, const fourvec & x1,
+				double & Tmax, double & vmax) const{
+		double Tmin;
+		bounds(x0, x1, Tmin, Tmax, vmax);
+	}
+};
+
+#endif
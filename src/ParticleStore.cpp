@@ -0,0 +1,110 @@
+#include "ParticleStore.h"
+#include <algorithm>
+
+void ParticleStore::resize_fields(size_t n){
+	pid.resize(n); freezeout.resize(n); mass.resize(n);
+	x.resize(n); p.resize(n);
+	t_rad.resize(n); t_absorb.resize(n);
+	p0.resize(n); vcell.resize(3*n); Tf.resize(n);
+}
+
+void ParticleStore::resize(size_t n){
+	resize_fields(n);
+	nactive = n;
+}
+
+particle ParticleStore::get(size_t i) const{
+	particle q;
+	q.pid = pid[i]; q.freezeout = freezeout[i]; q.mass = mass[i];
+	q.x = x[i]; q.p = p[i];
+	q.t_rad = t_rad[i]; q.t_absorb = t_absorb[i];
+	q.p0 = p0[i];
+	q.vcell.assign(vcell.begin()+3*i, vcell.begin()+3*i+3);
+	q.Tf = Tf[i];
+	return q;
+}
+
+void ParticleStore::set(size_t i, const particle & q){
+	pid[i] = q.pid; freezeout[i] = q.freezeout; mass[i] = q.mass;
+	x[i] = q.x; p[i] = q.p;
+	t_rad[i] = q.t_rad; t_absorb[i] = q.t_absorb;
+	p0[i] = q.p0;
+	for (size_t k=0; k<3; ++k)
+		vcell[3*i+k] = k < q.vcell.size() ? q.vcell[k] : 0.;
+	Tf[i] = q.Tf;
+}
+
+// moves the last particle of field to i, those from i on one place back
+template <typename T>
+void rotate_last(std::vector<T> & field, size_t i, size_t width=1){
+	std::rotate(field.begin()+width*i, field.end()-width, field.end());
+}
+
+void ParticleStore::push_back(const particle & q){
+	size_t n = size();
+	resize_fields(n+1);
+	set(n, q);
+	if (q.freezeout) return;
+	// a live particle goes after the live ones, before the frozen ones
+	if (nactive < n){
+		rotate_last(pid, nactive); rotate_last(freezeout, nactive);
+		rotate_last(mass, nactive);
+		rotate_last(x, nactive); rotate_last(p, nactive);
+		rotate_last(t_rad, nactive); rotate_last(t_absorb, nactive);
+		rotate_last(p0, nactive); rotate_last(vcell, nactive, 3);
+		rotate_last(Tf, nactive);
+	}
+	nactive ++;
+}
+
+template <typename T>
+void gather(std::vector<T> & field, const std::vector<size_t> & order,
+			size_t width=1){
+	std::vector<T> out(field.size());
+	for (size_t i=0; i<order.size(); ++i)
+		std::copy_n(field.begin()+width*order[i], width, out.begin()+width*i);
+	field.swap(out);
+}
+
+void ParticleStore::permute(const std::vector<size_t> & order){
+	gather(pid, order); gather(freezeout, order); gather(mass, order);
+	gather(x, order); gather(p, order);
+	gather(t_rad, order); gather(t_absorb, order);
+	gather(p0, order); gather(vcell, order, 3); gather(Tf, order);
+}
+
+// moves the particles listed in out, in increasing order, behind the
+// others of [0, n) in field, keeping the order of both; only the moved
+// ones are copied aside, the others close up in place
+template <typename T>
+void move_behind(std::vector<T> & field, const std::vector<size_t> & out,
+				size_t n, size_t width=1){
+	std::vector<T> aside;
+	aside.reserve(width*out.size());
+	size_t w = out[0], k = 0;
+	for (size_t i=out[0]; i<n; ++i){
+		auto first = field.begin()+width*i;
+		if (k < out.size() && out[k] == i){
+			aside.insert(aside.end(), first, first+width);
+			k ++;
+		}
+		else std::copy_n(first, width, field.begin()+width*(w++));
+	}
+	std::copy(aside.begin(), aside.end(), field.begin()+width*w);
+}
+
+size_t ParticleStore::compact(void){
+	std::vector<size_t> out;
+	for (size_t i=0; i<nactive; ++i)
+		if (freezeout[i]) out.push_back(i);
+	if (out.empty()) return 0;
+	// only the live range is touched, the frozen ones after it stay put
+	move_behind(pid, out, nactive); move_behind(freezeout, out, nactive);
+	move_behind(mass, out, nactive);
+	move_behind(x, out, nactive); move_behind(p, out, nactive);
+	move_behind(t_rad, out, nactive); move_behind(t_absorb, out, nactive);
+	move_behind(p0, out, nactive); move_behind(vcell, out, nactive, 3);
+	move_behind(Tf, out, nactive);
+	nactive -= out.size();
+	return out.size();
+}
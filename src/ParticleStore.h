@@ -0,0 +1,71 @@
+#ifndef PARTICLE_STORE_H
+#define PARTICLE_STORE_H
+
+#include <vector>
+#include "workflow.h"
+
+// A view of particle i of a ParticleStore, with the fields of particle
+// as references into the store, except vcell that points to 3 doubles.
+// It is only valid as long as the store is not resized.
+struct particle_ref{
+	int & pid;
+	char & freezeout;
+	double & mass;
+	fourvec & x;
+	fourvec & p;
+	double & t_rad, & t_absorb;
+	fourvec & p0;
+	double * vcell;
+	double & Tf;
+	void freestream(double dt){
+		double a = dt/p.t();
+		x.a[0] = x.t() + dt;
+		x.a[1] = x.x() + p.x()*a;
+		x.a[2] = x.y() + p.y()*a;
+		x.a[3] = x.z() + p.z()*a;
+	}
+};
+
+// Particles as a structure of arrays: one contiguous array per field, the
+// cell velocity as 3 doubles per particle in one array, so a loop over
+// one field of many particles streams through memory without touching
+// the others, and nothing is allocated per particle.
+// The particles [0, nactive) are the live ones, those after them have
+// frozen out, those of a later compact before those of an earlier one.
+struct ParticleStore{
+	size_t nactive;
+	std::vector<int> pid;
+	std::vector<char> freezeout;
+	std::vector<double> mass;
+	std::vector<fourvec> x, p;
+	std::vector<double> t_rad, t_absorb;
+	std::vector<fourvec> p0;
+	// vx, vy, vz of particle i at 3*i, 3*i+1, 3*i+2
+	std::vector<double> vcell;
+	std::vector<double> Tf;
+	ParticleStore(): nactive(0) {}
+	size_t size(void) const {return pid.size();}
+	// all particles are live after a resize
+	void resize(size_t n);
+	// resizes the fields only, nactive is left as it is
+	void resize_fields(size_t n);
+	void clear(void){resize(0);}
+	particle_ref operator[](size_t i){
+		return particle_ref{pid[i], freezeout[i], mass[i], x[i], p[i],
+							t_rad[i], t_absorb[i], p0[i], &vcell[3*i], Tf[i]};
+	}
+	void freestream(size_t i, double dt){(*this)[i].freestream(dt);}
+	// copies from and to the array of structures layout
+	particle get(size_t i) const;
+	void set(size_t i, const particle & q);
+	// a live particle is added after the live ones, a frozen one at the end
+	void push_back(const particle & q);
+	// reorders the particles so that the i-th is the order[i]-th before
+	void permute(const std::vector<size_t> & order);
+	// moves the live particles that have frozen out to the end of the live
+	// range, which then ends before them, keeping the order of both, and
+	// returns how many did
+	size_t compact(void);
+};
+
+#endif
@@ -7,6 +7,60 @@
 #include "matrix_elements.h"
 #include "Langevin.h"
 
+// values of x = log(1+E2/T) at which the 2->2 inverse CDF of cos(theta)
+// is tabulated, evenly spaced over [0, 3]
+const size_t icdf_nx = 16;
+
+// k from k*exp(-k/T) over [0, kmax], as a sum of two exponential draws
+inline double thermal_draw(double T, double kmax){
+	double k;
+	do{
+		k = -T*std::log((1.-Srandom::init_dis(Srandom::gen))
+					   *(1.-Srandom::init_dis(Srandom::gen)));
+	}while(k > kmax);
+	return k;
+}
+
+// a 3->2 point x = (k, E2, cosk, cos2, phi2) with k and E2 drawn from their
+// thermal shapes and the angles uniform
+inline void thermal_point(double T, double kmax, double * x){
+	x[0] = thermal_draw(T, kmax);
+	x[1] = thermal_draw(T, kmax);
+	x[2] = -1. + 2.*Srandom::init_dis(Srandom::gen);
+	x[3] = -1. + 2.*Srandom::init_dis(Srandom::gen);
+	x[4] = Srandom::dist_phi(Srandom::gen);
+}
+
+// rejection sampling of exp(-(k+E2)/T)*k*E2*residual from thermal_point,
+// only the residual is rejected on, against its bound wmax; the point goes
+// to x. A point above wmax raises it to 1.5 times its residual, and the
+// draw starts over; the point is counted in SamplerStat::overflow_nd, and
+// the caller may keep the raised wmax for its later draws.
+template <typename F>
+void sample_thermal(F residual, double T, double kmax, double & wmax,
+						bool & status, double * x){
+	int limit = 50000;
+	double y;
+	int counter = 0;
+	do{
+		thermal_point(T, kmax, x);
+		double r = residual(x);
+		y = r/wmax;
+		if (y > 1.0) {
+			LOG_WARNING << "thermal rejection, residual/wmax = " << y << " > 1, raised";
+			SamplerStat::overflow_nd ++;
+			wmax = 1.5*r;
+			y = 0.;
+		}
+		counter ++;
+	}while(Srandom::rejection(Srandom::gen)>y && counter < limit);
+	if(counter==limit) {
+		LOG_WARNING <<  "thermal rejection, too many tries = " << limit;
+		status = false;
+	}
+	SamplerStat::count_nd ++; SamplerStat::total_nd += counter;
+}
+
 template <>
 Rate<2, 2, double(*)(const double, void *)>::
 	Rate(std::string Name, std::string configfile, double(*f)(const double, void *)):
@@ -30,6 +84,15 @@ X(std::make_shared<Xsection<2, double(*)(const double, void *)>>(Name, configfil
 	// Set Approximate function for X and dX_max
 	StochasticBase<2>::_ZeroMoment->SetApproximateFunction(approx_R22);
 	StochasticBase<2>::_FunctionMax->SetApproximateFunction(approx_dR22_max);
+	_thermal = false;
+	// inverse CDFs of dR/dxdcos(theta) at (E, T)
+	if (StochasticBase<2>::_icdf > 0){
+		size_t K = StochasticBase<2>::_icdf;
+		_ICDF_x = StochasticBase<2>::add_extra<3>("icdf-x", {K}, {0.}, {1.});
+		_ICDF_cos = StochasticBase<2>::add_extra<4>("icdf-cos",
+						{icdf_nx, K}, {0., 0.}, {3., 1.});
+	}
+	StochasticBase<2>::add_envelope(2);
 }
 
 template <>
@@ -55,6 +118,8 @@ X(std::make_shared<Xsection<3, double(*)(const double*, void *)>>(Name, configfi
 	// Set Approximate function for X and dX_max
 	StochasticBase<3>::_ZeroMoment->SetApproximateFunction(approx_R23);
 	StochasticBase<3>::_FunctionMax->SetApproximateFunction(approx_dR23_max);
+	_thermal = false;
+	StochasticBase<3>::add_envelope(2);
 }
 
 template <>
@@ -80,6 +145,95 @@ X(std::make_shared<Xsection<4, double(*)(const double*, void *)>>(Name, configfi
 	// Set Approximate function for X and dX_max
 	//StochasticBase<3>::_ZeroMoment->SetApproximateFunction(approx_R32);
 	//StochasticBase<3>::_FunctionMax->SetApproximateFunction(approx_dR32_max);
+	// "uniform" (default) or "thermal" proposal
+	_thermal = (tree.get<std::string>("<xmlattr>.proposal", "uniform")=="thermal");
+	if (_thermal)
+		_ResidualMax = StochasticBase<3>::add_extra<3>("residual-max", {}, {}, {});
+	StochasticBase<3>::add_envelope(5);
+}
+
+template <size_t N1, size_t N2, typename F>
+void Rate<N1, N2, F>::set_proposal(std::string mode){
+	if (mode == "uniform") _thermal = false;
+	else if (mode == "thermal" && _ResidualMax) _thermal = true;
+	else {
+		LOG_FATAL << StochasticBase<N1>::_Name << " has no " << mode << " proposal";
+		exit(-1);
+	}
+}
+
+// dR of 3->2 without its thermal factor exp(-(k+E2)/T)*k*E2
+template <>
+double Rate<3, 4, double(*)(const double*, void *)>::
+		residual(double E, double T, double delta_t, const double * x){
+	double M = _mass;
+	double M2 = M*M;
+	double k = x[0], E2 = x[1], cosk = x[2], cos2 = x[3], phi2 = x[4];
+	double sink = std::sqrt(1.-cosk*cosk), sin2 = std::sqrt(1.-cos2*cos2);
+	double cosphi2 = std::cos(phi2), sinphi2 = std::sin(phi2);
+	double v1 = std::sqrt(1. - M*M/E/E);
+	fourvec p1mu{E, 0, 0, v1*E};
+	fourvec p2mu{E2, E2*sin2*cosphi2, E2*sin2*sinphi2, E2*cos2};
+	fourvec kmu{k, k*sink, 0., k*cosk};
+	fourvec Ptot = p1mu+p2mu+kmu, P12 = p1mu+p2mu, P1k = p1mu+kmu;
+	fourvec dxmu = {delta_t, 0., 0., delta_t*v1};
+	double s = dot(Ptot, Ptot), s12 = dot(P12, P12), s1k = dot(P1k, P1k);
+	double v12[3] = { P12.x()/P12.t(), P12.y()/P12.t(), P12.z()/P12.t() };
+	double dt12 = (dxmu.boost_to(v12[0], v12[1], v12[2])).t();
+	double xinel = (s12-M2)/(s-M2), yinel = (s1k/s-M2/s12)/(1.-s12/s)/(1.-M2/s12);
+	// interp Xsection
+	double arg[4] = {std::sqrt(s), T, xinel, yinel};
+	double Xtot = prefix_3to2(s, s12, s1k, dt12, M, T)*std::exp(X->GetZeroM(arg).s);
+	return Xtot/E/8./std::pow(2.*M_PI, 5);
+}
+
+// dR at x = (log(1+E2/T), cos(theta))
+template <>
+double Rate<2, 2, double(*)(const double, void*)>::
+		dR(const double * parameters, const double * x){
+	double E = parameters[0];
+	double T = parameters[1];
+	double M = _mass;
+	double v1 = std::sqrt(1. - std::pow(M/E,2));
+	double E2 = T*(std::exp(x[0])-1.), costheta = x[1];
+	if (costheta > 1. || costheta < -1.) return 0.;
+	double s = 2.*E2*E*(1. - v1*costheta) + M*M;
+	double arg[2] = {std::sqrt(s), T};
+	double Xtot = X->GetZeroM(arg).s;
+	double Jacobian = E2 + T;
+	return 1./E*E2*std::exp(-E2/T)*(s-M*M)*2*Xtot/16./M_PI/M_PI*Jacobian;
+}
+// dR at x = (log(1+E2/T), cos(theta))
+template <>
+double Rate<3, 3, double(*)(const double*, void*)>::
+		dR(const double * parameters, const double * x){
+	double E = parameters[0];
+	double T = parameters[1];
+	double delta_t = parameters[2];
+	double M = _mass;
+	double v1 = std::sqrt(1. - std::pow(M/E,2));
+	double E2 = T*(std::exp(x[0])-1.), costheta = x[1];
+	if (costheta > 1. || costheta < -1.) return 0.;
+	double s = 2.*E2*E*(1. - v1*costheta) + M*M;
+	// transform dt to center of mass frame
+	fourvec dxmu = {delta_t, 0., 0., delta_t*v1};
+	double sintheta = std::sqrt(1. - costheta*costheta);
+	double vcom[3] = { E2*sintheta/(E2+E), 0., (E2*costheta+v1*E)/(E2+E) };
+	double dt_com = (dxmu.boost_to(vcom[0], vcom[1], vcom[2])).t();
+	// interp cross-section
+	double arg[3] = {std::sqrt(s), T, dt_com};
+	double Xtot = X->GetZeroM(arg).s;
+	double Jacobian = E2 + T;
+	return 1./E*E2*std::exp(-E2/T)*(s-M*M)*2*Xtot/16./M_PI/M_PI*Jacobian;
+}
+// dR at x = (k, E2, cosk, cos2, phi2)
+template <>
+double Rate<3, 4, double(*)(const double*, void*)>::
+		dR(const double * parameters, const double * x){
+	double E = parameters[0];
+	double T = parameters[1];
+	double delta_t = parameters[2];
+	return std::exp(-(x[0]+x[1])/T)*x[0]*x[1]*residual(E, T, delta_t, x);
 }
 
 /*****************************************************************/
@@ -88,35 +242,46 @@ X(std::make_shared<Xsection<4, double(*)(const double*, void *)>>(Name, configfi
 /*------------------Implementation for 2 -> 2--------------------*/
 template <>
 void Rate<2, 2, double(*)(const double, void *)>::
-		sample(std::vector<double> parameters,
+		sample(const std::vector<double> & parameters,
 			std::vector< fourvec > & final_states){
 	double E = parameters[0];
 	double T = parameters[1];
 	double v1 = std::sqrt(1. - std::pow(_mass/E,2));
-	auto dR_dxdy = [E, T, v1, this](const double * x){
-		double M = this->_mass;
-		double E2 = T*(std::exp(x[0])-1.), costheta = x[1];
-		if (costheta > 1. || costheta < -1.) return 0.;
-		double s = 2.*E2*E*(1. - v1*costheta) + M*M;
-		double sqrts = std::sqrt(s);
-		double Xtot = this->X->GetZeroM({sqrts,T}).s;
-		double Jacobian = E2 + T;
-    	return 1./E*E2*std::exp(-E2/T)*(s-M*M)*2*Xtot/16./M_PI/M_PI*Jacobian;
+	auto dR_dxdy = [&parameters, this](const double * x){
+		return this->dR(parameters.data(), x);
 	};
-	bool status = true;
-	auto res = sample_nd(dR_dxdy, 2, {{0., 3.}, {-1., 1.}},
-						StochasticBase<2>::GetFmax(parameters).s, status);
-	if (status == false){
-		final_states.resize(1);
-		final_states[0] = fourvec{E, 0, 0, std::sqrt(E*E-_mass*_mass)};
-		return;
+	double res[2];
+	if (_ICDF_x){
+		// x from its marginal, then cos(theta) given x, no rejection
+		double arg[4] = {E, T, icdf_fraction(Srandom::init_dis(Srandom::gen)), 0.};
+		res[0] = 3.*_ICDF_x->InterpolateTable(arg).s;
+		arg[2] = res[0];
+		arg[3] = icdf_fraction(Srandom::init_dis(Srandom::gen));
+		res[1] = -1. + 2.*_ICDF_cos->InterpolateTable(arg).s;
+	}
+	else {
+		static const std::pair<double,double> range[2] = {{0., 3.}, {-1., 1.}};
+		bool status = true;
+		// without an envelope, against fmax
+		if (!sample_stratified(dR_dxdy, range, 2, StochasticBase<2>::_envelope,
+					StochasticBase<2>::envelope_cumulant(parameters.data()),
+					status, res))
+			sample_nd(dR_dxdy, 2, range,
+					StochasticBase<2>::GetFmax(parameters).s, status, res);
+		if (status == false){
+			final_states.resize(1);
+			final_states[0] = fourvec{E, 0, 0, std::sqrt(E*E-_mass*_mass)};
+			return;
+		}
 	}
 	double E2 = T*(std::exp(res[0])-1.),
 		   costheta = res[1];
 	double sintheta = std::sqrt(1. - costheta*costheta);
 	double s = 2.*E2*E*(1. - v1*costheta) + _mass*_mass;
-	double sqrts = std::sqrt(s);
-	X->sample({sqrts, T}, final_states);
+	// reused, so that the cross-section is sampled without allocation
+	static thread_local std::vector<double> argX(2);
+	argX[0] = std::sqrt(s); argX[1] = T;
+	X->sample(argX, final_states);
 
     // give incoming partilce a random phi angle
 	double phi = Srandom::dist_phi(Srandom::gen);
@@ -139,30 +304,23 @@ void Rate<2, 2, double(*)(const double, void *)>::
 /*------------------Implementation for 2 -> 3--------------------*/
 template <>
 void Rate<3, 3, double(*)(const double*, void *)>::
-		sample(std::vector<double> parameters,
+		sample(const std::vector<double> & parameters,
 			std::vector< fourvec > & final_states){
 	double E = parameters[0];
 	double T = parameters[1];
 	double delta_t = parameters[2];
 	double v1 = std::sqrt(1. - std::pow(_mass/E,2));
-	auto dR_dxdy = [E, T, delta_t, v1, this](const double * x){
-		double M = this->_mass;
-		double E2 = T*(std::exp(x[0])-1.), costheta = x[1];
-		if (costheta > 1. || costheta < -1.) return 0.;
-		double s = 2.*E2*E*(1. - v1*costheta) + M*M;
-		double sqrts = std::sqrt(s);
-		// transform dt to center of mass frame
-		fourvec dxmu = {delta_t, 0., 0., delta_t*v1};
-    	double sintheta = std::sqrt(1. - costheta*costheta);
-    	double vcom[3] = { E2*sintheta/(E2+E), 0., (E2*costheta+v1*E)/(E2+E) };
-    	double dt_com = (dxmu.boost_to(vcom[0], vcom[1], vcom[2])).t();
-    	// interp cross-section
-		double Xtot = this->X->GetZeroM({sqrts, T, dt_com}).s;
-		double Jacobian = E2 + T;
-    	return 1./E*E2*std::exp(-E2/T)*(s-M*M)*2*Xtot/16./M_PI/M_PI*Jacobian;
+	auto dR_dxdy = [&parameters, this](const double * x){
+		return this->dR(parameters.data(), x);
 	};
+	static const std::pair<double,double> range[2] = {{0., 3.}, {-1., 1.}};
 	bool status = true;
-	auto res = sample_nd(dR_dxdy, 2, {{0., 3.}, {-1., 1.}}, StochasticBase<3>::GetFmax(parameters).s, status);
+	double res[2];
+	if (!sample_stratified(dR_dxdy, range, 2, StochasticBase<3>::_envelope,
+				StochasticBase<3>::envelope_cumulant(parameters.data()),
+				status, res))
+		sample_nd(dR_dxdy, 2, range, StochasticBase<3>::GetFmax(parameters).s,
+				status, res);
 	if (status == false){
 		final_states.resize(1);
 		final_states[0] = fourvec{E, 0, 0, std::sqrt(E*E-_mass*_mass)};
@@ -191,7 +349,7 @@ void Rate<3, 3, double(*)(const double*, void *)>::
 /*------------------Implementation for 3 -> 2--------------------*/
 template <>
 void Rate<3, 4, double(*)(const double*, void *)>::
-		sample(std::vector<double> parameters,
+		sample(const std::vector<double> & parameters,
 			std::vector< fourvec > & final_states){
 	double E = parameters[0];
 	double T = parameters[1];
@@ -200,29 +358,30 @@ void Rate<3, 4, double(*)(const double*, void *)>::
 	double M2 = M*M;
 	// sample dR
 	// x are: k, E2, cosk, cos2, phi2
-	auto code = [E, T, delta_t, this](const double * x){
-		double M = this->_mass;
-		double M2 = M*M;
-		double k = x[0], E2 = x[1], cosk = x[2], cos2 = x[3], phi2 = x[4];
-		double sink = std::sqrt(1.-cosk*cosk), sin2 = std::sqrt(1.-cos2*cos2);
-		double cosphi2 = std::cos(phi2), sinphi2 = std::sin(phi2);
-		double v1 = std::sqrt(1. - M*M/E/E);
-		fourvec p1mu{E, 0, 0, v1*E};
-		fourvec p2mu{E2, E2*sin2*cosphi2, E2*sin2*sinphi2, E2*cos2};
-		fourvec kmu{k, k*sink, 0., k*cosk};
-		fourvec Ptot = p1mu+p2mu+kmu, P12 = p1mu+p2mu, P1k = p1mu+kmu;
-		fourvec dxmu = {delta_t, 0., 0., delta_t*v1};
-		double s = dot(Ptot, Ptot), s12 = dot(P12, P12), s1k = dot(P1k, P1k);
-		double sqrts = std::sqrt(s), sqrts12 = std::sqrt(s12), sqrts1k = std::sqrt(s1k);
-		double v12[3] = { P12.x()/P12.t(), P12.y()/P12.t(), P12.z()/P12.t() };
-		double dt12 = (dxmu.boost_to(v12[0], v12[1], v12[2])).t();
-		double xinel = (s12-M2)/(s-M2), yinel = (s1k/s-M2/s12)/(1.-s12/s)/(1.-M2/s12);
-		// interp Xsection
-		double Xtot = prefix_3to2(s, s12, s1k, dt12, M, T)*std::exp(this->X->GetZeroM({sqrts, T, xinel, yinel}).s);
-		return std::exp(-(k+E2)/T)*k*E2*Xtot/E/8./std::pow(2.*M_PI, 5);
+	auto residual = [E, T, delta_t, this](const double * x){
+		return this->residual(E, T, delta_t, x);
 	};
+	auto code = [&parameters, this](const double * x){
+		return this->dR(parameters.data(), x);
+	};
+	std::pair<double,double> range[5] = {{0.0*T, 10.0*T}, {0.0*T, 10.0*T},
+										 {-1., 1.}, {-1., 1.}, {0., 2.*M_PI}};
 	bool status = true;
-	auto res = sample_nd(code, 5, {{0.0*T, 10.0*T}, {0.0*T, 10.0*T}, {-1., 1.}, {-1., 1.}, {0., 2.*M_PI}}, std::exp(StochasticBase<3>::GetFmax(parameters).s), status);
+	std::vector<double> res(5);
+	if (_thermal){
+		// the bound is the largest of the grid points around, as raised by
+		// this thread where it did not hold
+		size_t cell;
+		double w0 = StochasticBase<3>::corner_bound(*_ResidualMax,
+								parameters.data(), cell), wmax = w0;
+		sample_thermal(residual, T, 10.*T, wmax, status, res.data());
+		if (wmax > w0) StochasticBase<3>::raise_bound(cell, wmax/w0);
+	}
+	else if (!sample_stratified(code, range, 5, StochasticBase<3>::_envelope,
+					StochasticBase<3>::envelope_cumulant(parameters.data()),
+					status, res.data()))
+		sample_nd(code, 5, range, std::exp(StochasticBase<3>::GetFmax(parameters).s),
+				status, res.data());
 	/*if (status == false){
 		final_states.resize(1);
 		final_states[0] = fourvec{E, 0, 0, std::sqrt(E*E-_mass*_mass)};
@@ -579,7 +738,7 @@ StochasticBase<3>(Name+"/rate", configfile),_f(f)
 //Sample Final states
 template <>
 void EffRate<3, double(*)(const double*, void *)>::
-		sample(std::vector<double> parameters,
+		sample(const std::vector<double> & parameters,
 			std::vector< fourvec > & final_states){
 	double E = parameters[0];
 	double T = parameters[1];
@@ -654,6 +813,102 @@ tensor EffRate<N, F>::calculate_tensor(std::vector<double> parameters){
 }
 
 
+/*****************************************************************/
+/*************************Sampled density of dR ******************/
+/*****************************************************************/
+/*------------------Implementation for 2 -> 2--------------------*/
+template <>
+void Rate<2, 2, double(*)(const double, void*)>::
+		sampled_density(std::vector<double> parameters, density & f,
+				std::vector<std::pair<double,double>> & range){
+	f = [parameters, this](const double * x){return this->dR(parameters.data(), x);};
+	range = {{0., 3.}, {-1., 1.}};
+}
+/*------------------Implementation for 2 -> 3--------------------*/
+template <>
+void Rate<3, 3, double(*)(const double*, void*)>::
+		sampled_density(std::vector<double> parameters, density & f,
+				std::vector<std::pair<double,double>> & range){
+	f = [parameters, this](const double * x){return this->dR(parameters.data(), x);};
+	range = {{0., 3.}, {-1., 1.}};
+}
+/*------------------Implementation for 3 -> 2--------------------*/
+template <>
+void Rate<3, 4, double(*)(const double*, void*)>::
+		sampled_density(std::vector<double> parameters, density & f,
+				std::vector<std::pair<double,double>> & range){
+	double T = parameters[1];
+	f = [parameters, this](const double * x){return this->dR(parameters.data(), x);};
+	range = {{0.0*T, 10.0*T}, {0.0*T, 10.0*T}, {-1., 1.}, {-1., 1.}, {0., 2.*M_PI}};
+}
+
+/*****************************************************************/
+/*************************Inverse CDF of dR **********************/
+/*****************************************************************/
+/*------------------Default Implementation-----------------------*/
+template <size_t N1, size_t N2, typename F>
+Dvec Rate<N1, N2, F>::calculate_extra(std::vector<double>){
+	return Dvec();
+}
+/*------------------Implementation for 2 -> 2--------------------*/
+template <>
+Dvec Rate<2, 2, double(*)(const double, void*)>::
+		calculate_extra(std::vector<double> parameters){
+	// only the envelope may be tabulated
+	if (!_ICDF_x) return Dvec();
+	// the same density as the rejection sampling, in x = log(1+E2/T) and y
+	auto dR_dxdy = [&parameters, this](double x, double y){
+		double xy[2] = {x, y};
+		return this->dR(parameters.data(), xy);
+	};
+	// marginal in x, the y integral by the trapezoidal rule
+	auto dR_dx = [&dR_dxdy](double x){
+		const size_t ny = 64;
+		double sum = .5*(dR_dxdy(x, -1.) + dR_dxdy(x, 1.));
+		for(size_t j=1; j<ny; j++) sum += dR_dxdy(x, -1. + 2.*j/ny);
+		return sum*2./ny;
+	};
+	size_t K = StochasticBase<2>::_icdf;
+	Dvec res = inverse_cdf(dR_dx, {0., 3.}, K, 200);
+	for(size_t i=0; i<icdf_nx; i++){
+		double x = 3.*i/(icdf_nx-1);
+		auto dR_dy = [&dR_dxdy, x](double y){return dR_dxdy(x, y);};
+		Dvec q = inverse_cdf(dR_dy, {-1., 1.}, K);
+		res.insert(res.end(), q.begin(), q.end());
+	}
+	return res;
+}
+/*------------------Implementation for 3 -> 2--------------------*/
+template <>
+Dvec Rate<3, 4, double(*)(const double*, void*)>::
+		calculate_extra(std::vector<double> parameters){
+	// the residual bound is only tabulated for the thermal proposal
+	if (!_ResidualMax) return Dvec();
+	double E = parameters[0];
+	double T = parameters[1];
+	double delta_t = parameters[2];
+	// the largest residual on a lattice of L points per axis over the range
+	// of the proposal, with the same safety factor as fmax. The residual is
+	// not defined at k = 0 or E2 = 0, where it is largest, and is taken at
+	// 1e-3 T instead, where it has reached its limit.
+	const size_t L = 9;
+	double low[5] = {1e-3*T, 1e-3*T, -1., -1., 0.},
+		   high[5] = {10.*T, 10.*T, 1., 1., 2.*M_PI};
+	size_t nnodes = 1;
+	for(size_t i=0; i<5; i++) nnodes *= L;
+	double x[5], wmax = 0.;
+	for(size_t n=0; n<nnodes; n++){
+		size_t q = n;
+		for(int i=4; i>=0; i--){
+			x[i] = low[i] + (high[i] - low[i])*(q%L)/(L-1.);
+			q /= L;
+		}
+		double r = residual(E, T, delta_t, x);
+		if (std::isfinite(r)) wmax = std::max(wmax, r);
+	}
+	return Dvec{wmax*2.};
+}
+
 template class Rate<2,2,double(*)(const double, void*)>; // For 2->2
 template class Rate<3,3,double(*)(const double*, void*)>; // For 2->3
 template class Rate<3,4,double(*)(const double*, void*)>; // For 3->2
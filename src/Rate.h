@@ -22,15 +22,44 @@ private:
 	scalar calculate_scalar(std::vector<double> parameters);
 	fourvec calculate_fourvec(std::vector<double> parameters);
 	tensor calculate_tensor(std::vector<double> parameters);
+	Dvec calculate_extra(std::vector<double> parameters);
+	// the density sample() draws from at x, for the parameters of the rate
+	// table, and sampled_density() gives for the envelope
+	double dR(const double * parameters, const double * x);
+	void sampled_density(std::vector<double> parameters,
+				typename StochasticBase<N1>::density & f,
+				std::vector<std::pair<double,double>> & range);
 	double _mass, _degen;
 	bool _active;
+	// 2->2: inverse CDFs of x = log(1+E2/T) over [0, 3], and of cos(theta)
+	// over [-1, 1] given x, as fractions of the ranges
+	std::shared_ptr<TableBase<scalar, 3>> _ICDF_x;
+	std::shared_ptr<TableBase<scalar, 4>> _ICDF_cos;
+	// 3->2: k and E2 drawn from their thermal k*exp(-k/T) shapes, then kept
+	// with the rest of dR over its tabulated bound
+	bool _thermal;
+	std::shared_ptr<TableBase<scalar, 3>> _ResidualMax;
+	// 3->2: dR without its thermal factor at x = (k, E2, cosk, cos2, phi2),
+	// what the thermal proposal rejects on
+	double residual(double E, double T, double delta_t, const double * x);
 public:
 	Rate(std::string Name, std::string configfile, F f);
-	void sample(std::vector<double> arg, 
-				std::vector< fourvec > & FS);
+	// final, so that it is called directly through a Rate pointer
+	void sample(const std::vector<double> & arg, 
+				std::vector< fourvec > & FS) final;
 	void initX(std::string fname){X->init(fname);}
-	void loadX(std::string fname){X->load(fname);}
+	TableGenerator * generatorX(void){return X.get();}
+	bool loadX(std::string fname){return X->load(fname);}
+	bool loadX(H5::H5File & file){return X->load(file);}
+	std::string NameX(void){return X->Name();}
+	void initX_shard(std::string fname, size_t shard, size_t nshards){
+		X->init_shard(fname, shard, nshards);}
+	bool mergeX(std::vector<std::string> shards, std::string fname){
+		return X->merge(shards, fname);}
 	bool IsActive(void) {return _active;}
+	// "uniform" or "thermal" proposal of the 3->2 sampling, the latter
+	// needs the tables of proposal="thermal"
+	void set_proposal(std::string mode);
 };
 
 // Diffusion induced rate: (effective rate)
@@ -50,7 +79,7 @@ private:
 	bool _active;
 public:
 	EffRate(std::string Name, std::string configfile, F f);
-	void sample(std::vector<double> arg, 
+	void sample(const std::vector<double> & arg, 
 				std::vector< fourvec > & FS);
 	bool IsActive(void) {return _active;}
 };
@@ -1,8 +1,11 @@
 #include "StochasticBase.h"
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
-#include <thread>
+#include <algorithm>
+#include <cmath>
 #include "simpleLogger.h"
+#include "random.h"
+#include "sampler.h"
 template<size_t N>
 StochasticBase<N>::StochasticBase(std::string Name, std::string configfile):
 _Name(Name)
@@ -21,94 +24,392 @@ _Name(Name)
 	// whether calculate moments of the object
 	auto tree1 = config.get_child(model_name+"."+process_name);
 	_with_moments = (tree1.get<std::string>("<xmlattr>.moments")=="on")?true:false;
+	// inverse-CDF tables to sample from, if the process has any
+	_icdf = tree1.get<size_t>("<xmlattr>.icdf", 0);
+	if (_icdf == 1) _icdf = 2; // at least both ends
+	// VEGAS proposals to sample from, if the process has any
+	_vegas = tree1.get<size_t>("<xmlattr>.vegas", 0);
+	// envelope to sample from, if the process has one
+	_envelope = tree1.get<size_t>("<xmlattr>.envelope", 0);
+	_nboxes = 0;
+	// threads used to generate the tables, set per process or for the whole
+	// model, 0 means all hardware threads
+	_nthreads = tree1.get<size_t>("<xmlattr>.threads",
+				config.get<size_t>(model_name+".<xmlattr>.threads", 0));
+	// seconds between two checkpoints of an unfinished table
+	_checkpoint_interval = tree1.get<double>("<xmlattr>.checkpoint",
+				config.get<double>(model_name+".<xmlattr>.checkpoint", 60.));
 
 	auto tree = config.get_child(model_name+"."+process_name+"."+quantity_name);
 	std::string allslots = tree.get<std::string>("<xmlattr>.slots");
 	boost::split(slots, allslots, boost::is_any_of(",") );
 
-	std::vector<size_t> shape;
-	std::vector<double> low, high;
 	for(auto & v : slots){
-		shape.push_back(tree.get<size_t>("N"+v));
-		low.push_back(tree.get<double>("L"+v));
-		high.push_back(tree.get<double>("H"+v));
+		_shape.push_back(tree.get<size_t>("N"+v));
+		_low.push_back(tree.get<double>("L"+v));
+		_high.push_back(tree.get<double>("H"+v));
 	}
 
 
     _FunctionMax =
-		std::make_shared<TableBase<scalar, N>>(Name+"/fmax", shape, low, high);
+		std::make_shared<TableBase<scalar, N>>(Name+"/fmax", _shape, _low, _high);
 	_ZeroMoment =
-		std::make_shared<TableBase<scalar, N>>(Name+"/scalar", shape, low, high);
+		std::make_shared<TableBase<scalar, N>>(Name+"/scalar", _shape, _low, _high);
 	if (_with_moments){
 		_FirstMoment =
-			std::make_shared<TableBase<fourvec, N>>(Name+"/vector", shape, low, high);
+			std::make_shared<TableBase<fourvec, N>>(Name+"/vector", _shape, _low, _high);
 		_SecondMoment =
-			std::make_shared<TableBase<tensor, N>>(Name+"/tensor", shape, low, high);
+			std::make_shared<TableBase<tensor, N>>(Name+"/tensor", _shape, _low, _high);
 	}
 }
 
 template<size_t N>
-void StochasticBase<N>::load(std::string fname){
+bool StochasticBase<N>::load(std::string fname){
 	LOG_INFO << "Loading " << _Name+"/fmax";
-    _FunctionMax->Load(fname);
+	if (!_FunctionMax->Load(fname)) return false;
 	LOG_INFO << "Loading " << _Name+"/scalar";
-	_ZeroMoment->Load(fname);
+	if (!_ZeroMoment->Load(fname)) return false;
 	if (_with_moments){
 		LOG_INFO << "Loading " << _Name+"/vector";
-		_FirstMoment->Load(fname);
+		if (!_FirstMoment->Load(fname)) return false;
 		LOG_INFO << "Loading " << _Name+"/tensor";
-		_SecondMoment->Load(fname);
+		if (!_SecondMoment->Load(fname)) return false;
 	}
+	for(auto & table : _Extra)
+		if (!table->Load(fname)) return false;
+	build_envelope();
+	return true;
 }
 
+template<size_t N>
+bool StochasticBase<N>::load(H5::H5File & file){
+	LOG_INFO << "Loading " << _Name;
+	bool status = _FunctionMax->Load(file) && _ZeroMoment->Load(file);
+	if (status && _with_moments)
+		status = _FirstMoment->Load(file) && _SecondMoment->Load(file);
+	for(auto & table : _Extra)
+		status = status && table->Load(file);
+	if (status) build_envelope();
+	return status;
+}
+
+template<size_t N>
+void StochasticBase<N>::save_checkpoint(std::string fname,
+					const std::vector<unsigned char> & done){
+	_FunctionMax->SaveCheckpoint(fname, done);
+	_ZeroMoment->SaveCheckpoint(fname, done);
+	if (_with_moments){
+		_FirstMoment->SaveCheckpoint(fname, done);
+		_SecondMoment->SaveCheckpoint(fname, done);
+	}
+	// the points of an extra table at a grid point share its flag
+	for(auto & table : _Extra){
+		size_t m = table->length()/done.size();
+		std::vector<unsigned char> flags(table->length());
+		for(size_t i=0; i<flags.size(); ++i) flags[i] = done[i/m];
+		table->SaveCheckpoint(fname, flags);
+	}
+}
+
+// a point counts as done only if it is done in every table
+template<size_t N>
+bool StochasticBase<N>::load_checkpoint(std::string fname,
+					std::vector<unsigned char> & done){
+	std::vector<unsigned char> flags;
+	auto merge = [&done, &flags](bool status){
+		if (!status) return false;
+		for(size_t i=0; i<done.size(); ++i) done[i] = done[i] && flags[i];
+		return true;
+	};
+	done.assign(_ZeroMoment->length(), 1);
+	bool status = merge(_FunctionMax->LoadCheckpoint(fname, flags))
+			   && merge(_ZeroMoment->LoadCheckpoint(fname, flags));
+	if (status && _with_moments)
+		status = merge(_FirstMoment->LoadCheckpoint(fname, flags))
+			  && merge(_SecondMoment->LoadCheckpoint(fname, flags));
+	for(auto & table : _Extra){
+		if (!status) break;
+		status = table->LoadCheckpoint(fname, flags);
+		size_t m = table->length()/done.size();
+		for(size_t i=0; status && i<flags.size(); ++i)
+			done[i/m] = done[i/m] && flags[i];
+	}
+	if (!status) done.assign(_ZeroMoment->length(), 0);
+	return status;
+}
+
+template<size_t N>
+void StochasticBase<N>::clear_checkpoint(std::string fname){
+	_FunctionMax->ClearCheckpoint(fname);
+	_ZeroMoment->ClearCheckpoint(fname);
+	if (_with_moments){
+		_FirstMoment->ClearCheckpoint(fname);
+		_SecondMoment->ClearCheckpoint(fname);
+	}
+	for(auto & table : _Extra) table->ClearCheckpoint(fname);
+}
 
 template<size_t N>
 void StochasticBase<N>::init(std::string fname){
-	LOG_INFO << _Name << " Generating tables";
-	auto code = [this](int start, int end) { this->compute(start, end); };
-	std::vector<std::thread> threads;
-	size_t nthreads = std::thread::hardware_concurrency();
-	size_t padding = size_t(std::ceil(_ZeroMoment->length()*1./nthreads));
-	for(auto i=0; i<nthreads; ++i) {
-		int start = i*padding;
-		int end = std::min(padding*(i+1), _ZeroMoment->length());
-		threads.push_back( std::thread(code, start, end) );
-	}
-	for(auto& t : threads) t.join();
+	TableScheduler scheduler(_nthreads);
+	scheduler.add(this, fname);
+	scheduler.run();
+}
 
+template<size_t N>
+void StochasticBase<N>::init_shard(std::string fname, size_t shard, size_t nshards){
+	TableScheduler scheduler(_nthreads);
+	scheduler.add(this, fname, std::vector<size_t>(), shard, nshards);
+	scheduler.run();
+}
+
+template<size_t N>
+bool StochasticBase<N>::merge(std::vector<std::string> shards, std::string fname){
+	size_t length = _ZeroMoment->length();
+	std::vector<unsigned char> done(length, 0), flags;
+	for(auto & shard : shards){
+		if (!load_checkpoint(shard, flags)) {
+			LOG_ERROR << _Name << " not found in " << shard;
+			return false;
+		}
+		for(size_t i=0; i<length; ++i) done[i] = done[i] || flags[i];
+	}
+	size_t missing = std::count(done.begin(), done.end(), 0);
+	if (missing > 0) {
+		LOG_ERROR << _Name << " " << missing << " of " << length
+				  << " points are in none of the shards";
+		return false;
+	}
 	_FunctionMax->Save(fname);
 	_ZeroMoment->Save(fname);
 	if (_with_moments){
 		_FirstMoment->Save(fname);
 		_SecondMoment->Save(fname);
 	}
+	for(auto & table : _Extra) table->Save(fname);
+	build_envelope();
+	return true;
+}
+
+template<size_t N>
+size_t StochasticBase<N>::begin(std::string fname, size_t shard, size_t nshards){
+	_generation = std::make_shared<generation>();
+	auto & G = *_generation;
+	G.fname = fname;
+	G.sharded = (nshards > 1);
+	G.start = std::chrono::steady_clock::now();
+	G.last_checkpoint = G.start;
+	// resume from the checkpoint of an interrupted run if there is one
+	load_checkpoint(fname, G.done);
+	// shards interleave, so that each gets a fair share of the costly corners
+	size_t length = _ZeroMoment->length(), share = 0;
+	for(size_t i=shard; i<length; i+=nshards, ++share)
+		if (!G.done[i]) G.todo.push_back(i);
+	if (G.todo.size() < share)
+		LOG_INFO << _Name << " resumed from checkpoint, "
+				 << share-G.todo.size() << " of " << share << " points done";
+	LOG_INFO << _Name << " Generating " << G.todo.size() << " points";
+	return G.todo.size();
+}
+
+template<size_t N>
+void StochasticBase<N>::run(size_t k){
+	auto & G = *_generation;
+	size_t i = G.todo[k];
+	// each grid point draws from its own substream of the master seed
+	Srandom::set_stream(i);
+	auto values = compute(i);
+	// tables are only touched under the lock, so that a checkpoint
+	// always sees completed points
+	std::lock_guard<std::mutex> guard(G.lock);
+	store(values);
+	G.done[i] = 1;
+	auto now = std::chrono::steady_clock::now();
+	if (std::chrono::duration<double>(now - G.last_checkpoint).count()
+		> _checkpoint_interval){
+		save_checkpoint(G.fname, G.done);
+		G.last_checkpoint = now;
+	}
+}
+
+template<size_t N>
+void StochasticBase<N>::end(void){
+	auto & G = *_generation;
+	if (G.sharded) save_checkpoint(G.fname, G.done);
+	else {
+		_FunctionMax->Save(G.fname);
+		_ZeroMoment->Save(G.fname);
+		if (_with_moments){
+			_FirstMoment->Save(G.fname);
+			_SecondMoment->Save(G.fname);
+		}
+		for(auto & table : _Extra) table->Save(G.fname);
+		clear_checkpoint(G.fname);
+		build_envelope();
+	}
+	double wall = std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - G.start).count();
+	LOG_INFO << _Name << " " << G.todo.size() << " points in " << wall << " s";
+	_generation.reset();
+}
+
+template<size_t N>
+typename StochasticBase<N>::point StochasticBase<N>::compute(size_t i){
+	point values;
+	values.i = i;
+	values.index.resize(N);
+	size_t q = i;
+	for(int d=N-1; d>=0; d--){
+		size_t dim = _ZeroMoment->shape(d);
+		values.index[d] = q%dim;
+		q = q/dim;
+	}
+	values.fmax = find_max(_FunctionMax->parameters(values.index));
+	values.zero = calculate_scalar(_ZeroMoment->parameters(values.index));
+	if (_with_moments){
+		values.first = calculate_fourvec(_FirstMoment->parameters(values.index));
+		values.second = calculate_tensor(_SecondMoment->parameters(values.index));
+	}
+	if (!_Extra.empty())
+		values.extra = calculate_extra(_ZeroMoment->parameters(values.index));
+	// the envelope is the last of the extra tables
+	if (_Envelope){
+		density f;
+		std::vector<std::pair<double,double>> range;
+		sampled_density(_ZeroMoment->parameters(values.index), f, range);
+		auto maxima = envelope_maxima(f, range, _envelope);
+		values.extra.insert(values.extra.end(), maxima.begin(), maxima.end());
+	}
+	return values;
+}
+
+template<size_t N>
+void StochasticBase<N>::store(const point & values){
+	_FunctionMax->SetTableValue(values.index, values.fmax);
+	_ZeroMoment->SetTableValue(values.index, values.zero);
+	if (_with_moments){
+		_FirstMoment->SetTableValue(values.index, values.first);
+		_SecondMoment->SetTableValue(values.index, values.second);
+	}
+	// the extra values are the blocks of the extra tables, in their order
+	size_t nextra = 0;
+	for(auto & table : _Extra)
+		nextra += table->length()/_ZeroMoment->length()*table->components();
+	if (values.extra.size() != nextra){
+		LOG_FATAL << _Name << " has " << values.extra.size()
+				  << " extra values at a grid point, its extra tables take " << nextra;
+		exit(-1);
+	}
+	const double * v = values.extra.data();
+	for(auto & table : _Extra){
+		size_t m = table->length()/_ZeroMoment->length();
+		table->SetTableValues(values.i*m, v, m);
+		v += m*table->components();
+	}
+}
+
+template<size_t N>
+void StochasticBase<N>::locate(const double * parameters, size_t * first,
+								double * w){
+	for(size_t d=0; d<N; ++d){
+		double x = (parameters[d] - _low[d])/(_high[d] - _low[d])*(_shape[d]-1);
+		first[d] = std::min(size_t(std::max(std::floor(x), 0.)), _shape[d]-2);
+		w[d] = std::min(std::max(x - first[d], 0.), 1.);
+	}
+}
+
+template<size_t N>
+size_t StochasticBase<N>::corner(const size_t * first, size_t c){
+	size_t index = 0;
+	for(size_t d=0; d<N; ++d)
+		index = index*_shape[d] + first[d] + ((c >> (N-1-d)) & 1);
+	return index;
 }
 
 template<size_t N>
-void StochasticBase<N>::compute(int start, int end){
-	std::vector<size_t> index;
-	index.resize(N);
-	for(auto i=start; i<end; ++i){
-		size_t q = i;
+void StochasticBase<N>::corners(const double * parameters, size_t * index,
+								double * weight){
+	size_t first[N];
+	double w[N];
+	locate(parameters, first, w);
+	for(size_t c=0; c<(size_t(1)<<N); ++c){
+		index[c] = corner(first, c);
+		weight[c] = 1.;
+		for(size_t d=0; d<N; ++d)
+			weight[c] *= ((c >> (N-1-d)) & 1) ? w[d] : 1.-w[d];
+	}
+}
+
+// the factors by which the samplers of a thread raised the bounds of the
+// tables, by object and cell
+static thread_local std::map<std::pair<const void *, size_t>, double> raised_bounds;
+
+template<size_t N>
+double StochasticBase<N>::corner_bound(TableBase<scalar, N> & table,
+							const double * parameters, size_t & cell){
+	size_t first[N];
+	double w[N], bound = 0.;
+	locate(parameters, first, w);
+	cell = corner(first, 0);
+	for(size_t c=0; c<(size_t(1)<<N); ++c)
+		bound = std::max(bound, table.GetTableValue(corner(first, c)).s);
+	if (!raised_bounds.empty()){
+		auto it = raised_bounds.find({this, cell});
+		if (it != raised_bounds.end()) bound *= it->second;
+	}
+	return bound;
+}
+
+template<size_t N>
+void StochasticBase<N>::raise_bound(size_t cell, double factor){
+	if (!(factor > 1.) || !std::isfinite(factor)) return;
+	auto it = raised_bounds.find({this, cell});
+	if (it == raised_bounds.end()) raised_bounds[{this, cell}] = factor;
+	else it->second *= factor;
+}
+
+template<size_t N>
+void StochasticBase<N>::add_envelope(size_t dim){
+	if (_envelope == 0) return;
+	_nboxes = 1;
+	for(size_t i=0; i<dim; ++i) _nboxes *= _envelope;
+	_Envelope = add_extra<N+1>("envelope", {_nboxes}, {0.}, {_nboxes-1.});
+}
+
+template<size_t N>
+void StochasticBase<N>::build_envelope(void){
+	if (!_Envelope) return;
+	size_t ncells = 1;
+	for(size_t d=0; d<N; ++d) ncells *= _shape[d]-1;
+	_EnvelopeCumulant.assign(ncells*_nboxes, 0.);
+	size_t first[N], index[size_t(1)<<N];
+	for(size_t cell=0; cell<ncells; ++cell){
+		size_t q = cell;
 		for(int d=N-1; d>=0; d--){
-			size_t dim = _ZeroMoment->shape(d);
-			size_t n = q%dim;
-			q = q/dim;
-			index[d] = n;
+			first[d] = q%(_shape[d]-1);
+			q /= _shape[d]-1;
 		}
-		_FunctionMax->SetTableValue(index,
-						find_max(_FunctionMax->parameters(index))	);
-		_ZeroMoment->SetTableValue(index,
-						calculate_scalar(_ZeroMoment->parameters(index))	);
-		if (_with_moments){
-			_FirstMoment->SetTableValue(index,
-							calculate_fourvec(_FirstMoment->parameters(index))	);
-			_SecondMoment->SetTableValue(index,
-							calculate_tensor(_SecondMoment->parameters(index))	);
+		for(size_t c=0; c<(size_t(1)<<N); ++c) index[c] = corner(first, c);
+		double * cumulant = _EnvelopeCumulant.data() + cell*_nboxes, total = 0.;
+		for(size_t b=0; b<_nboxes; ++b){
+			double m = 0.;
+			for(size_t c=0; c<(size_t(1)<<N); ++c)
+				m = std::max(m, _Envelope->GetTableValue(index[c]*_nboxes + b).s);
+			cumulant[b] = (total += m);
 		}
 	}
 }
 
+template<size_t N>
+const double * StochasticBase<N>::envelope_cumulant(const double * parameters){
+	if (_EnvelopeCumulant.empty()) return nullptr;
+	size_t first[N], cell = 0;
+	double w[N];
+	locate(parameters, first, w);
+	for(size_t d=0; d<N; ++d) cell = cell*(_shape[d]-1) + first[d];
+	return _EnvelopeCumulant.data() + cell*_nboxes;
+}
+
 template class StochasticBase<2>;
 template class StochasticBase<3>;
 template class StochasticBase<4>;
@@ -6,10 +6,14 @@
 #include <string>
 #include <random>
 #include <map>
+#include <mutex>
+#include <chrono>
+#include <functional>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/algorithm/string.hpp>
 #include "TableBase.h"
+#include "TableScheduler.h"
 //	double (*dXdPS)(double * PS, size_t n_dims, void * params);
 // this base defines how a stochasitc object
 // 1) calculate the probablity of a event with input parameters (0th moment)
@@ -19,7 +23,7 @@
 // 5) given inputs, sample the output parameters
 
 template <size_t N>
-class StochasticBase{
+class StochasticBase: public TableGenerator{
 protected:
 	const std::string _Name;
     // the maximum of the distribution with given parameters, used in rejection
@@ -32,18 +36,119 @@ protected:
     std::shared_ptr<TableBase<fourvec, N>> _FirstMoment;
 	// 2-nd moments of the distribution: <p^mu p^nu>, i.e. the correlator
     std::shared_ptr<TableBase<tensor, N>> _SecondMoment;
-	void compute(int start, int end);
+	// tables a derived class adds on the grid of this object, extended by
+	// dimensions of its own, that are generated, saved and loaded along
+	// with the ones above
+	std::vector<std::shared_ptr<TableStorage>> _Extra;
+	template <size_t M>
+	std::shared_ptr<TableBase<scalar, M>> add_extra(std::string name,
+							Svec shape, Dvec low, Dvec high){
+		shape.insert(shape.begin(), _shape.begin(), _shape.end());
+		low.insert(low.begin(), _low.begin(), _low.end());
+		high.insert(high.begin(), _high.begin(), _high.end());
+		auto table = std::make_shared<TableBase<scalar, M>>(
+							_Name+"/"+name, shape, low, high);
+		_Extra.push_back(table);
+		return table;
+	}
+	// the tabulated quantities at one grid point
+	struct point{
+		size_t i;
+		Svec index;
+		scalar fmax, zero;
+		fourvec first;
+		tensor second;
+		Dvec extra;
+	};
+	// computes grid point i of the flattened table, store() puts it in
+	point compute(size_t i);
+	void store(const point & values);
+	void save_checkpoint(std::string, const std::vector<unsigned char> & done);
+	bool load_checkpoint(std::string, std::vector<unsigned char> & done);
+	void clear_checkpoint(std::string);
+	// state of a table generation in progress, the points left are todo,
+	// they are checkpointed to fname as they finish
+	struct generation{
+		std::string fname;
+		bool sharded;
+		std::vector<size_t> todo;
+		std::vector<unsigned char> done;
+		std::mutex lock;
+		std::chrono::steady_clock::time_point start, last_checkpoint;
+	};
+	std::shared_ptr<generation> _generation;
     virtual scalar find_max(std::vector<double> parameters) = 0;
     virtual scalar calculate_scalar(std::vector<double> parameters) = 0;
     virtual fourvec calculate_fourvec(std::vector<double> parameters) = 0;
     virtual tensor calculate_tensor(std::vector<double> parameters) = 0;
+	// the values of all the extra tables at a grid point: for each table
+	// in order, its points over the extra dimensions in row-major order
+	virtual Dvec calculate_extra(std::vector<double>)
+			{return Dvec();}
+	Svec _shape;
+	Dvec _low, _high;
 	bool _with_moments;
+	// number of probabilities of the inverse-CDF tables, 0 if there are none
+	size_t _icdf;
+	// number of bins per axis of the VEGAS proposals, 0 if there are none
+	size_t _vegas;
+	// the density the sampler of the object draws from at parameters, over
+	// the box range, for those that take an envelope
+	typedef std::function<double(const double *)> density;
+	virtual void sampled_density(std::vector<double>, density &,
+				std::vector<std::pair<double,double>> &){}
+	// number of sub-boxes per axis of the envelope, 0 if there is none
+	size_t _envelope;
+	// maxima of the sampled density over its sub-boxes, in one extra
+	// dimension, used instead of fmax
+	std::shared_ptr<TableBase<scalar, N+1>> _Envelope;
+	// to be called by a derived class after its other add_extra, with the
+	// dimension of its sampled density
+	void add_envelope(size_t dim);
+	// The envelope sampled from in a cell of the grid takes, for each
+	// sub-box, the largest maximum at the 2^N corners of the cell, so that
+	// it bounds the density between them. Its cumulative sums over the
+	// sub-boxes of each cell are built once the table is loaded or made.
+	size_t _nboxes;
+	std::vector<double> _EnvelopeCumulant;
+	void build_envelope(void);
+	// the cumulative sums of the cell of parameters, nullptr if there are none
+	const double * envelope_cumulant(const double * parameters);
+	// the 2^N grid points around parameters, as flattened indices of the
+	// grid of the tables, and their weights in the interpolation; an extra
+	// table holds the m points of grid point i from i*m on
+	void corners(const double * parameters, size_t * index, double * weight);
+	// first[d] of the cell that holds parameters, and the position in it
+	void locate(const double * parameters, size_t * first, double * w);
+	// flattened index of corner c of the cell of lowest corner first
+	size_t corner(const size_t * first, size_t c);
+	// the largest value of a bound table over the 2^N corners of the cell of
+	// parameters, so that it holds between them, times the factor by which
+	// a sampler of this thread had to raise it there; cell receives the
+	// index of the lowest corner
+	double corner_bound(TableBase<scalar, N> & table, const double * parameters,
+				size_t & cell);
+	// a sampler of this thread found a point above the bound of cell, and
+	// had to raise it by factor
+	void raise_bound(size_t cell, double factor);
+	size_t _nthreads;
+	double _checkpoint_interval;
 public:
 	StochasticBase(std::string Name, std::string configfile);
-	scalar GetFmax(std::vector<double> arg) {
+	scalar GetFmax(const std::vector<double> & arg) {
 			return _FunctionMax->InterpolateTable(arg);};
-	scalar GetZeroM(std::vector<double> arg) {
+	scalar GetZeroM(const std::vector<double> & arg) {
 			return _ZeroMoment->InterpolateTable(arg);};
+	// allocation-free versions, arg points to N parameters
+	scalar GetFmax(const double * arg) {
+			return _FunctionMax->InterpolateTable(arg);};
+	scalar GetZeroM(const double * arg) {
+			return _ZeroMoment->InterpolateTable(arg);};
+	// batched versions, args[d][i] is the d-th parameter of the i-th query
+	void GetFmax(const double * const * args, size_t n, scalar * out) {
+			_FunctionMax->InterpolateTable(args, n, out);};
+	void GetZeroM(const double * const * args, size_t n, scalar * out) {
+			_ZeroMoment->InterpolateTable(args, n, out);};
 	fourvec GetFirstM(std::vector<double> arg) {
 			if (_with_moments) return _FirstMoment->InterpolateTable(arg);
 			else return fourvec{0,0,0,0};
@@ -52,10 +157,23 @@ public:
 			if (_with_moments) return _SecondMoment->InterpolateTable(arg);
 			else return tensor{0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 		};
-	virtual void sample(std::vector<double> arg,
+	virtual void sample(const std::vector<double> & arg,
 						std::vector< fourvec > & FS) = 0;
+	// TableGenerator: computes the points shard, shard+nshards, ...
+	// that are not done yet
+	size_t begin(std::string fname, size_t shard, size_t nshards);
+	void run(size_t k);
+	void end(void);
+	// generates the tables, resuming from a checkpoint in the file if any
 	void init(std::string);
-	void load(std::string);
+	// false if a table is missing from the file
+	bool load(std::string);
+	bool load(H5::H5File & file);
+	// generates only shard k of nshards into its own file, and merges
+	// the shard files into the final tables of fname
+	void init_shard(std::string fname, size_t shard, size_t nshards);
+	bool merge(std::vector<std::string> shards, std::string fname);
+	std::string Name(void) {return _Name;}
 };
 
 #endif
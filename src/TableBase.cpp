@@ -4,78 +4,228 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <iostream>
+#include <mutex>
 #include "simpleLogger.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// batched lookups are processed in blocks small enough to live on the stack
+const size_t batch_block = 64;
+
+// the HDF5 library is not thread-safe, and tables of different processes
+// are saved to the same file, so all file access goes one at a time
+std::mutex hdf5_lock;
 
 // Default approximation function
 
 template <typename T>
-T default_approximate_function(Dvec values){
+T default_approximate_function(const double * values){
 	return T::unity();
 }
 
 template <typename T, size_t N>
 TableBase<T, N>::TableBase(std::string Name, Svec shape, Dvec low, Dvec high):
 _Name(Name), _rank(N), _power_rank(std::pow(2, _rank)),
-_shape(shape), _low(low), _high(high),_table(_shape)
+_shape(shape), _low(low), _high(high),_table(_shape), _normed_table(_shape)
 {
 	LOG_INFO<<_Name << " dim=" << _rank;
 	for(auto i=0; i<_rank; ++i){
 		_step.push_back((high[i]-low[i])/(shape[i]-1));
 	}
+	set_stride();
 	// Set default approximation function to return 1
 	ApproximateFunction = default_approximate_function<T>;
 }
 
 template <typename T, size_t N>
-T TableBase<T, N>::InterpolateTable(Dvec values){
-   Svec start_index;
-   Dvec w;
-   for(auto i=0; i<_rank; ++i) {
+void TableBase<T, N>::set_stride(void){
+	_stride.resize(_rank);
+	size_t stride = 1;
+	for(int i=_rank-1; i>=0; --i){
+		_stride[i] = stride;
+		stride *= _shape[i];
+	}
+	_corner_offset.resize(_power_rank);
+	for(size_t c=0; c<_power_rank; ++c){
+		_corner_offset[c] = 0;
+		for(size_t d=0; d<_rank; ++d)
+			if (c & (1<<d)) _corner_offset[c] += _stride[d];
+	}
+}
+
+template <typename T, size_t N>
+void TableBase<T, N>::normalize(void){
+	double corner_values[N];
+	for(size_t i=0; i<_table.num_elements(); ++i){
+		size_t q = i;
+		for(int d=N-1; d>=0; d--){
+			corner_values[d] = _low[d] + _step[d]*(q%_shape[d]);
+			q /= _shape[d];
+		}
+		T f = _table.data()[i];
+		_normed_table.data()[i] = f/ApproximateFunction(corner_values);
+	}
+}
+
+template <typename T, size_t N>
+template <size_t D>
+T TableBase<T, N>::corner_blend(size_t offset, const double * w,
+					std::integral_constant<size_t, D>){
+	auto next = std::integral_constant<size_t, D+1>();
+	T lower = corner_blend(offset, w, next);
+	T upper = corner_blend(offset+_stride[D], w, next);
+	return lower*(1.-w[D]) + upper*w[D];
+}
+
+template <typename T, size_t N>
+T TableBase<T, N>::corner_blend(size_t offset, const double * w,
+					std::integral_constant<size_t, N>){
+	return _normed_table.data()[offset];
+}
+
+template <typename T, size_t N>
+T TableBase<T, N>::InterpolateTable(const double * values){
+   double w[N];
+   size_t offset = 0;
+   for(size_t i=0; i<N; ++i) {
        auto x = (values[i]-_low[i])/_step[i];
-       x = std::min(std::max(x, 0.), _shape[i]-2.); // cut at lower and higher bounds bounds
-       size_t nx = size_t(std::floor(x));
-       double rx = x-nx;
-       start_index.push_back(nx);
-       w.push_back(rx);
-   }
-   Svec index(_rank);
-   T result{0.};
-   Dvec corner_values(_rank); // hold x values at the corner of the hyper cube
-   for(auto i=0; i<_power_rank; ++i) {
-        auto W = 1.0;
-        for (auto j=0; j<_rank; ++j) {
-            index[j] = start_index[j] + ((i & ( 1 << j )) >> j);
-            W *= (index[j]==start_index[j])?(1.-w[j]):w[j];
-            corner_values[j] = _low[j] + _step[j]*index[j];
-        }
-        // We interp f/f_approx
-        result = result + _table(index)/ApproximateFunction(corner_values)*W;
+       x = std::min(std::max(x, 0.), _shape[i]-1.); // cut at lower and higher bounds bounds
+       // the last cell reaches up to the last grid point
+       size_t nx = std::min(size_t(std::floor(x)), _shape[i]-2);
+       w[i] = x-nx;
+       offset += nx*_stride[i];
    }
+   // We interp f/f_approx, which is tabulated already
+   T result = corner_blend(offset, w, std::integral_constant<size_t, 0>());
    // multiply the interp function back with f_approx
    return result*ApproximateFunction(values);
 }
 
+template <typename T, size_t N>
+void TableBase<T, N>::locate_batch(size_t d, const double * x, size_t m,
+					size_t * offset, double * w){
+	const double low = _low[d], step = _step[d], high = _shape[d]-1.,
+				 last = _shape[d]-2.;
+	const size_t stride = _stride[d];
+	size_t k = 0;
+#ifdef __AVX2__
+	const __m256d vlow = _mm256_set1_pd(low), vstep = _mm256_set1_pd(step),
+				  vzero = _mm256_setzero_pd(), vhigh = _mm256_set1_pd(high),
+				  vlast = _mm256_set1_pd(last);
+	const __m256i vstride = _mm256_set1_epi64x(stride);
+	for(; k+4<=m; k+=4){
+		__m256d y = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(x+k), vlow), vstep);
+		y = _mm256_min_pd(_mm256_max_pd(y, vzero), vhigh);
+		__m256d ny = _mm256_min_pd(_mm256_floor_pd(y), vlast);
+		_mm256_storeu_pd(w+k, _mm256_sub_pd(y, ny));
+		// ny >= 0 and small, 32x32->64 bit multiply is enough
+		__m256i nx = _mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(ny));
+		__m256i off = _mm256_loadu_si256((const __m256i *)(offset+k));
+		off = _mm256_add_epi64(off, _mm256_mul_epu32(nx, vstride));
+		_mm256_storeu_si256((__m256i *)(offset+k), off);
+	}
+#endif
+	for(; k<m; ++k){
+		auto y = (x[k]-low)/step;
+		y = std::min(std::max(y, 0.), high);
+		size_t nx = size_t(std::min(std::floor(y), last));
+		w[k] = y-nx;
+		offset[k] += nx*stride;
+	}
+}
+
+template <typename T, size_t N>
+void TableBase<T, N>::blend_batch(const size_t * offset, const double * w,
+					size_t stride_w, size_t m, T * out){
+	size_t k = 0;
+#ifdef __AVX2__
+	// a scalar table is a plain array of doubles, gather the corners directly
+	if (std::is_same<T, scalar>::value){
+		const double * base = reinterpret_cast<const double *>(_normed_table.data());
+		double * res = reinterpret_cast<double *>(out);
+		const __m256d one = _mm256_set1_pd(1.);
+		for(; k+4<=m; k+=4){
+			__m256i off = _mm256_loadu_si256((const __m256i *)(offset+k));
+			__m256d wd[N], acc = _mm256_setzero_pd();
+			for(size_t d=0; d<N; ++d) wd[d] = _mm256_loadu_pd(w+d*stride_w+k);
+			for(size_t c=0; c<_power_rank; ++c){
+				__m256i idx = _mm256_add_epi64(off,
+									_mm256_set1_epi64x(_corner_offset[c]));
+				__m256d W = one;
+				for(size_t d=0; d<N; ++d)
+					W = _mm256_mul_pd(W, (c & (1<<d)) ? wd[d]
+										: _mm256_sub_pd(one, wd[d]));
+				acc = _mm256_add_pd(acc,
+						_mm256_mul_pd(_mm256_i64gather_pd(base, idx, 8), W));
+			}
+			_mm256_storeu_pd(res+k, acc);
+		}
+	}
+#endif
+	double wk[N];
+	for(; k<m; ++k){
+		for(size_t d=0; d<N; ++d) wk[d] = w[d*stride_w+k];
+		out[k] = corner_blend(offset[k], wk, std::integral_constant<size_t, 0>());
+	}
+}
+
+template <typename T, size_t N>
+void TableBase<T, N>::InterpolateTable(const double * const * coords,
+					size_t n, T * out){
+	size_t offset[batch_block];
+	double w[N*batch_block];
+	double point[N];
+	for(size_t start=0; start<n; start+=batch_block){
+		size_t m = std::min(batch_block, n-start);
+		for(size_t k=0; k<m; ++k) offset[k] = 0;
+		for(size_t d=0; d<N; ++d)
+			locate_batch(d, coords[d]+start, m, offset, w+d*batch_block);
+		blend_batch(offset, w, batch_block, m, out+start);
+		// multiply the interp function back with f_approx
+		for(size_t k=0; k<m; ++k){
+			for(size_t d=0; d<N; ++d) point[d] = coords[d][start+k];
+			out[start+k] = out[start+k]*ApproximateFunction(point);
+		}
+	}
+}
+
 template <typename T, size_t N>
 void TableBase<T, N>::SetTableValue(Svec index, T v){
     _table(index) = v;
+    Dvec corner_values = parameters(index);
+    _normed_table(index) = v/ApproximateFunction(corner_values.data());
 }
 
 template <typename T, size_t N>
-bool TableBase<T, N>::Save(std::string fname){
-	H5::Exception::dontPrint(); // suppress error messages
-	// the is a dumb implementation
-	H5::H5File file;
-	if( boost::filesystem::exists(fname)) file = H5::H5File(fname, H5F_ACC_RDWR);
-	else file = H5::H5File(fname, H5F_ACC_TRUNC);
+void TableBase<T, N>::SetTableValues(size_t offset, const double * v, size_t n){
+	Svec index(N);
+	for(size_t k=0; k<n; ++k){
+		size_t q = offset + k;
+		for(int d=N-1; d>=0; d--){
+			index[d] = q%_shape[d];
+			q = q/_shape[d];
+		}
+		T value;
+		for(size_t comp=0; comp<T::size(); ++comp)
+			value.set(comp, v[k*T::size()+comp]);
+		SetTableValue(index, value);
+	}
+}
+
+// Open the group at path, creating the missing levels. With rebuild, an
+// existing group at path is deleted and created again.
+H5::Group open_group(H5::H5File & file, std::string path, bool rebuild){
 	std::vector<std::string> levels;
-	boost::split(levels, _Name, boost::is_any_of("/"));
+	boost::split(levels, path, boost::is_any_of("/"));
 	std::string prefix = "";
 	H5::Group group;
 	for (auto& v : levels) {
+		if (v.empty()) continue;
 		prefix += ("/"+v);
   		try{
     		group = file.openGroup(prefix.c_str());
-			if (prefix == "/"+_Name) {	// if the last group existed before
+			if (rebuild && prefix == path) {	// if the last group existed before
 				// It need to be deleted and rebuild
 				H5Ldelete(file.getId(), prefix.c_str(), H5P_DEFAULT);
 				LOG_WARNING<<"old data deleted and will be overwirtten";
@@ -85,7 +235,31 @@ bool TableBase<T, N>::Save(std::string fname){
     		group = file.createGroup(prefix.c_str());
  		}
 	}
+	return group;
+}
 
+// Write data to the dataset name of the group, it is created on first use
+void write_dataset(H5::Group & group, std::string name, int rank,
+		const hsize_t * dims, const void * data, const H5::PredType & datatype){
+	H5::DataSet dataset;
+	try{
+		dataset = group.openDataSet(name.c_str());
+	}catch (...) {
+		H5::DSetCreatPropList proplist{};
+		proplist.setChunk(rank, dims);
+		H5::DataSpace dataspace(rank, dims);
+		dataset = group.createDataSet(name.c_str(), datatype, dataspace, proplist);
+	}
+	dataset.write(data, datatype);
+}
+
+H5::H5File open_file(std::string fname){
+	if( boost::filesystem::exists(fname)) return H5::H5File(fname, H5F_ACC_RDWR);
+	else return H5::H5File(fname, H5F_ACC_TRUNC);
+}
+
+template <typename T, size_t N>
+void TableBase<T, N>::write(H5::Group & group){
 	hdf5_add_scalar_attr(group, "rank", _rank);
 	for (auto i=0; i<_rank; ++i){
 		hdf5_add_scalar_attr(group, "shape-"+std::to_string(i), _shape[i]);
@@ -96,37 +270,38 @@ bool TableBase<T, N>::Save(std::string fname){
 	boost::multi_array<double, N> buffer(_shape);
 	hsize_t dims[_rank];
 	for (auto i=0; i<_rank; ++i) dims[i]=_shape[i];
-	H5::DSetCreatPropList proplist{};
-	proplist.setChunk(_rank, dims);
-
-	H5::DataSpace dataspace(_rank, dims);
-	auto datatype(H5::PredType::NATIVE_DOUBLE);
-
 	for(auto comp=0; comp<T::size(); ++comp) {
 		for(auto i=0; i<_table.num_elements(); ++i) {
 			T item = _table.data()[i];
 			buffer.data()[i] = item.get(comp);
 		}
-		auto dsname = prefix+"/"+std::to_string(comp);
-		H5::DataSet dataset = file.createDataSet(dsname, datatype, dataspace, proplist);
-		dataset.write(buffer.data(), datatype);
+		write_dataset(group, std::to_string(comp), _rank, dims,
+					  buffer.data(), H5::PredType::NATIVE_DOUBLE);
 	}
+}
+
+template <typename T, size_t N>
+bool TableBase<T, N>::Save(std::string fname){
+	std::lock_guard<std::mutex> guard(hdf5_lock);
+	H5::Exception::dontPrint(); // suppress error messages
+	H5::H5File file = open_file(fname);
+	H5::Group group = open_group(file, "/"+_Name, true);
+	write(group);
 	file.close();
 	return true;
 }
 
 template <typename T, size_t N>
-bool TableBase<T, N>::Load(std::string fname){
-	H5::H5File file(fname, H5F_ACC_RDONLY);
-	H5::Group group = H5::Group( file.openGroup( "/"+_Name ));
-	size_t temp_rank;
-	hdf5_read_scalar_attr(group, "rank", temp_rank);
-	if (temp_rank != _rank) {
-		LOG_FATAL<< "Table rank does not match";
-		file.close();
-		return false;
-	}
-	else{
+bool TableBase<T, N>::read(H5::H5File & file){
+	H5::Exception::dontPrint();
+	try{
+		H5::Group group = H5::Group( file.openGroup( "/"+_Name ));
+		size_t temp_rank;
+		hdf5_read_scalar_attr(group, "rank", temp_rank);
+		if (temp_rank != _rank) {
+			LOG_FATAL<< "Table rank does not match";
+			return false;
+		}
 		LOG_INFO<< "Rank compitable, loading table";
 		for (auto i=0; i<_rank; ++i){
 			hdf5_read_scalar_attr(group, "shape-"+std::to_string(i), _shape[i]);
@@ -134,28 +309,130 @@ bool TableBase<T, N>::Load(std::string fname){
 			hdf5_read_scalar_attr(group, "high-"+std::to_string(i), _high[i]);
 			_step[i] = (_high[i] - _low[i])/(_shape[i]-1.);
 		}
+		set_stride();
 		_table.resize(_shape);
-		hsize_t dims[_rank];
-		for (auto i=0; i<_rank; ++i) dims[i]=_shape[i];
+		_normed_table.resize(_shape);
+		// T is a plain array of T::size() doubles, so the table is seen as
+		// a 1D array of doubles and component comp is read straight into
+		// every T::size()-th of them, without an intermediate buffer
+		hsize_t length = _table.num_elements()*T::size(),
+				count = _table.num_elements(), stride = T::size();
+		H5::DataSpace memspace(1, &length);
+		for(hsize_t comp=0; comp<T::size(); ++comp) {
+			H5::DataSet dataset = group.openDataSet(std::to_string(comp));
+			memspace.selectHyperslab(H5S_SELECT_SET, &count, &comp, &stride);
+			dataset.read(_table.data(), H5::PredType::NATIVE_DOUBLE,
+						 memspace, dataset.getSpace());
+		}
+	}catch (H5::Exception &) {
+		LOG_WARNING << _Name << " not found";
+		return false;
+	}
+	return true;
+}
+
+template <typename T, size_t N>
+bool TableBase<T, N>::Load(std::string fname){
+	{
+		std::lock_guard<std::mutex> guard(hdf5_lock);
+		H5::Exception::dontPrint();
+		try{
+			H5::H5File file(fname, H5F_ACC_RDONLY);
+			if (!read(file)) return false;
+			file.close();
+		}catch (H5::Exception &) {
+			LOG_WARNING << fname << " cannot be opened";
+			return false;
+		}
+	}
+	normalize();
+	return true;
+}
+
+template <typename T, size_t N>
+bool TableBase<T, N>::Load(H5::H5File & file){
+	{
+		std::lock_guard<std::mutex> guard(hdf5_lock);
+		if (!read(file)) return false;
+	}
+	// the normalization does not touch the file, it runs in parallel
+	normalize();
+	return true;
+}
+
+template <typename T, size_t N>
+bool TableBase<T, N>::SaveCheckpoint(std::string fname,
+					const std::vector<unsigned char> & done){
+	std::lock_guard<std::mutex> guard(hdf5_lock);
+	H5::Exception::dontPrint();
+	H5::H5File file = open_file(fname);
+	H5::Group group = open_group(file, "/checkpoint/"+_Name, false);
+	write(group);
+	hsize_t length = done.size();
+	write_dataset(group, "done", 1, &length, done.data(),
+				  H5::PredType::NATIVE_UCHAR);
+	file.close();
+	return true;
+}
+
+template <typename T, size_t N>
+bool TableBase<T, N>::LoadCheckpoint(std::string fname,
+					std::vector<unsigned char> & done){
+	std::lock_guard<std::mutex> guard(hdf5_lock);
+	H5::Exception::dontPrint();
+	try{
+		H5::H5File file(fname, H5F_ACC_RDONLY);
+		H5::Group group = file.openGroup("/checkpoint/"+_Name);
+		// only resume on the same grid
+		size_t temp_rank, temp_shape;
+		double temp_low, temp_high;
+		hdf5_read_scalar_attr(group, "rank", temp_rank);
+		if (temp_rank != _rank) return false;
+		for (auto i=0; i<_rank; ++i){
+			hdf5_read_scalar_attr(group, "shape-"+std::to_string(i), temp_shape);
+			hdf5_read_scalar_attr(group, "low-"+std::to_string(i), temp_low);
+			hdf5_read_scalar_attr(group, "high-"+std::to_string(i), temp_high);
+			if (temp_shape != _shape[i] || temp_low != _low[i]
+				|| temp_high != _high[i]) {
+				LOG_WARNING << _Name << " checkpoint is on another grid, ignored";
+				return false;
+			}
+		}
+		done.resize(_table.num_elements());
+		group.openDataSet("done").read(done.data(), H5::PredType::NATIVE_UCHAR);
+		// only the points held by the checkpoint are taken, so that several
+		// partial tables can be merged into one
 		boost::multi_array<double, N> buffer(_shape);
-		H5::DataSpace dataspace(_rank, dims);
-		auto datatype(H5::PredType::NATIVE_DOUBLE);
 		for(auto comp=0; comp<T::size(); ++comp) {
-			H5::DataSet dataset = file.openDataSet("/"+_Name+"/"+std::to_string(comp));
-			dataset.read(buffer.data(), H5::PredType::NATIVE_DOUBLE,
-						 dataspace, dataset.getSpace());
+			H5::DataSet dataset = group.openDataSet(std::to_string(comp));
+			dataset.read(buffer.data(), H5::PredType::NATIVE_DOUBLE);
 			for(auto i=0; i<_table.num_elements(); ++i) {
-				_table.data()[i].set(comp, buffer.data()[i]);
+				if (done[i]) _table.data()[i].set(comp, buffer.data()[i]);
 			}
 		}
 		file.close();
+		normalize();
+	}catch (H5::Exception &) {
+		return false;
 	}
 	return true;
 }
 
+template <typename T, size_t N>
+void TableBase<T, N>::ClearCheckpoint(std::string fname){
+	std::lock_guard<std::mutex> guard(hdf5_lock);
+	H5::Exception::dontPrint();
+	try{
+		H5::H5File file(fname, H5F_ACC_RDWR);
+		H5Ldelete(file.getId(), ("/checkpoint/"+_Name).c_str(), H5P_DEFAULT);
+		file.close();
+	}catch (H5::Exception &) {}
+}
+
 template class TableBase<scalar, 2>;
 template class TableBase<scalar, 3>;
 template class TableBase<scalar, 4>;
+template class TableBase<scalar, 5>;
 template class TableBase<fourvec, 2>;
 template class TableBase<fourvec, 3>;
 template class TableBase<fourvec, 4>;
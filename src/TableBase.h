@@ -3,35 +3,102 @@
 
 #include <vector>
 #include <string>
+#include <type_traits>
+#include <mutex>
 #include <boost/multi_array.hpp>
 #include <iostream>
 #include "lorentz.h"
 
+namespace H5 { class Group; class H5File; }
+
+// held around every call into the HDF5 library, which is not thread-safe
+extern std::mutex hdf5_lock;
+
 typedef std::vector<double> Dvec;
 typedef std::vector<size_t> Svec;
 
+// What the owner of tables of different types and dimensions needs, to
+// fill, save and load them together
+class TableStorage{
+public:
+    virtual ~TableStorage(){}
+    virtual bool Save(std::string) = 0;
+    virtual bool Load(std::string) = 0;
+    virtual bool Load(H5::H5File & file) = 0;
+    virtual bool SaveCheckpoint(std::string,
+                        const std::vector<unsigned char> & done) = 0;
+    virtual bool LoadCheckpoint(std::string, std::vector<unsigned char> & done) = 0;
+    virtual void ClearCheckpoint(std::string) = 0;
+    // n consecutive points of the flattened table from offset, given as
+    // components() doubles each
+    virtual void SetTableValues(size_t offset, const double * v, size_t n) = 0;
+    virtual size_t components(void) = 0;
+    virtual size_t length(void) = 0;
+};
+
 // Base class of a table of type T with dimension N
 template <typename T, size_t N>
-class TableBase{
+class TableBase: public TableStorage{
 protected:
     const std::string _Name;
     const size_t _rank, _power_rank;
     Svec _shape;
     Dvec _low, _high;
     Dvec _step;
+    Svec _stride; // flattened (row-major) offset of a unit step in each dim
+    Svec _corner_offset; // flattened offset of each of the 2^N corners
     boost::multi_array<T, N> _table;
-    T(*ApproximateFunction)(Dvec values);
+    // f/f_approx at the grid points, this is what actually gets interpolated
+    boost::multi_array<T, N> _normed_table;
+    T(*ApproximateFunction)(const double * values);
+    void set_stride(void);
+    void normalize(void);
+    // write the grid attributes and one dataset per component to group
+    void write(H5::Group & group);
+    // read the grid and the components of group /_Name, hdf5_lock held
+    bool read(H5::H5File & file);
+    // multilinear blend of the 2^N corners, unrolled over D at compile time
+    template <size_t D>
+    T corner_blend(size_t offset, const double * w,
+                   std::integral_constant<size_t, D>);
+    T corner_blend(size_t offset, const double * w,
+                   std::integral_constant<size_t, N>);
+    // batch helpers: grid location along dim d, then blend of m points
+    void locate_batch(size_t d, const double * x, size_t m,
+                      size_t * offset, double * w);
+    void blend_batch(const size_t * offset, const double * w, size_t stride_w,
+                     size_t m, T * out);
 public:
 	TableBase(std::string, Svec, Dvec, Dvec);
-	T InterpolateTable(Dvec values);
+	// values points to N coordinates, no heap allocation on this path
+	T InterpolateTable(const double * values);
+	T InterpolateTable(const Dvec & values){
+		return InterpolateTable(values.data());
+	}
+	// batched version in structure-of-arrays layout:
+	// coords[d][i] is the d-th coordinate of the i-th query point
+	void InterpolateTable(const double * const * coords, size_t n, T * out);
+    // the value at a point of the flattened table, no interpolation
+    T GetTableValue(size_t offset) {return _table.data()[offset];}
     void SetTableValue(Svec index, T v);
-    void SetApproximateFunction(T(*f)(Dvec values)){
+    void SetTableValues(size_t offset, const double * v, size_t n);
+    void SetApproximateFunction(T(*f)(const double * values)){
     	ApproximateFunction = f;
+    	normalize();
     	};
     bool Save(std::string);
     bool Load(std::string);
+    // from a file already open, to load many tables with one open
+    bool Load(H5::H5File & file);
+    // partially generated table (interrupted run or shard), kept under
+    // /checkpoint/ with a bitmap done[i] of the grid points it holds;
+    // loading it only overwrites those points
+    bool SaveCheckpoint(std::string, const std::vector<unsigned char> & done);
+    bool LoadCheckpoint(std::string, std::vector<unsigned char> & done);
+    void ClearCheckpoint(std::string);
 	size_t shape(size_t i) {return _shape[i];}
 	size_t rank(void) {return _rank;}
+	size_t components(void) {return T::size();}
 	size_t length(void) {
 		size_t result=1; 
 		for(auto& D : _shape) result *= D;
@@ -0,0 +1,73 @@
+#include "TableRegistry.h"
+#include "TableBase.h"
+#include "H5Cpp.h"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <boost/filesystem.hpp>
+#include "simpleLogger.h"
+
+TableRegistry::TableRegistry(std::string fname, size_t nthreads):
+_fname(fname), _nthreads(nthreads)
+{
+	if (_nthreads == 0) _nthreads = std::thread::hardware_concurrency();
+	if (_nthreads == 0) _nthreads = 1;
+}
+
+void TableRegistry::add(std::string name,
+				std::function<bool(H5::H5File &)> loader){
+	_names.push_back(name);
+	_loaders.push_back(loader);
+}
+
+size_t TableRegistry::load(void){
+	for(auto & name : _names) _loaded[name] = false;
+	if (_loaders.empty()) return 0;
+	if (!boost::filesystem::exists(_fname)) {
+		LOG_WARNING << _fname << " not found, no table loaded";
+		return 0;
+	}
+	auto start = std::chrono::steady_clock::now();
+	H5::H5File file;
+	{
+		std::lock_guard<std::mutex> guard(hdf5_lock);
+		H5::Exception::dontPrint();
+		try{
+			file.openFile(_fname, H5F_ACC_RDONLY);
+		}catch (H5::Exception &) {
+			LOG_WARNING << _fname << " cannot be opened, no table loaded";
+			return 0;
+		}
+	}
+	// the flags are written by one thread each, never resized meanwhile
+	std::vector<char> status(_loaders.size(), 0);
+	std::atomic<size_t> next(0);
+	auto code = [this, &file, &status, &next](){
+		size_t i;
+		while ( (i = next++) < _loaders.size() )
+			status[i] = _loaders[i](file);
+	};
+	size_t nthreads = std::min(_nthreads, _loaders.size());
+	std::vector<std::thread> threads;
+	for(size_t i=0; i<nthreads; ++i) threads.push_back( std::thread(code) );
+	for(auto & t : threads) t.join();
+	{
+		std::lock_guard<std::mutex> guard(hdf5_lock);
+		file.close();
+	}
+	size_t nloaded = 0;
+	for(size_t i=0; i<_names.size(); ++i){
+		_loaded[_names[i]] = status[i];
+		if (status[i]) nloaded ++;
+	}
+	double wall = std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+	LOG_INFO << nloaded << " of " << _names.size() << " tables loaded from "
+			 << _fname << " in " << wall << " s with " << nthreads << " threads";
+	return nloaded;
+}
+
+bool TableRegistry::loaded(std::string name) const {
+	auto it = _loaded.find(name);
+	return it != _loaded.end() && it->second;
+}
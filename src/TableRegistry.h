@@ -0,0 +1,32 @@
+#ifndef TABLE_REGISTRY_H
+#define TABLE_REGISTRY_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <functional>
+
+namespace H5 { class H5File; }
+
+// Loads many tables from one file at startup. The file is opened once for
+// all of them, and the tables load concurrently: the reads from the file
+// still go one at a time, the work on the data read runs in parallel.
+class TableRegistry{
+private:
+	std::string _fname;
+	size_t _nthreads;
+	std::vector<std::string> _names;
+	std::vector<std::function<bool(H5::H5File &)>> _loaders;
+	std::map<std::string, bool> _loaded;
+public:
+	// nthreads = 0 uses all hardware threads
+	TableRegistry(std::string fname, size_t nthreads=0);
+	// loader reads the table name from the open file, false if it is missing
+	void add(std::string name, std::function<bool(H5::H5File &)> loader);
+	// loads all the tables added, returns the number loaded
+	size_t load(void);
+	// whether the table name has been loaded
+	bool loaded(std::string name) const;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "TableScheduler.h"
+#include <thread>
+#include <chrono>
+#include <functional>
+#include "simpleLogger.h"
+
+TableScheduler::TableScheduler(size_t nthreads):
+_nthreads(nthreads), _ended(0)
+{
+	if (_nthreads == 0) _nthreads = std::thread::hardware_concurrency();
+	if (_nthreads == 0) _nthreads = 1;
+}
+
+size_t TableScheduler::add(TableGenerator * table, std::string fname,
+			std::vector<size_t> after, size_t shard, size_t nshards){
+	size_t id = _jobs.size();
+	_jobs.push_back(job{table, fname, shard, nshards, 0,
+						std::vector<size_t>(), false, 0, 0, 0});
+	for(auto & j : after){
+		if (j >= id) {
+			LOG_FATAL << "a table can only depend on tables added before it";
+			exit(-1);
+		}
+		_jobs[j].dependents.push_back(id);
+		_jobs[id].waiting ++;
+	}
+	return id;
+}
+
+void TableScheduler::end_job(size_t j, std::unique_lock<std::mutex> & guard){
+	guard.unlock();
+	_jobs[j].table->end();
+	guard.lock();
+	_ended ++;
+	for(auto & d : _jobs[j].dependents) _jobs[d].waiting --;
+	_ready.notify_all();
+}
+
+void TableScheduler::work(size_t & npoints, double & busy){
+	std::unique_lock<std::mutex> guard(_lock);
+	while (_ended < _jobs.size()){
+		// the earliest job that is free to start or has points left
+		size_t j = 0;
+		for(; j<_jobs.size(); ++j){
+			auto & J = _jobs[j];
+			if (J.waiting == 0 && (!J.started || J.next < J.size)) break;
+		}
+		if (j == _jobs.size()) {
+			_ready.wait(guard);
+			continue;
+		}
+		auto & J = _jobs[j];
+		if (!J.started){
+			J.started = true;
+			guard.unlock();
+			size_t size = J.table->begin(J.fname, J.shard, J.nshards);
+			guard.lock();
+			J.size = size;
+			if (J.size == 0) end_job(j, guard);
+			else _ready.notify_all();
+			continue;
+		}
+		size_t k = J.next++;
+		guard.unlock();
+		auto start = std::chrono::steady_clock::now();
+		J.table->run(k);
+		busy += std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+		npoints ++;
+		guard.lock();
+		if (++J.finished == J.size) end_job(j, guard);
+	}
+}
+
+void TableScheduler::run(void){
+	if (_jobs.empty()) return;
+	LOG_INFO << "Generating " << _jobs.size() << " tables with "
+			 << _nthreads << " threads";
+	std::vector<size_t> npoints(_nthreads, 0);
+	std::vector<double> busy(_nthreads, 0.);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for(size_t i=0; i<_nthreads; ++i)
+		threads.push_back( std::thread(&TableScheduler::work, this,
+								std::ref(npoints[i]), std::ref(busy[i])) );
+	for(auto& t : threads) t.join();
+	double wall = std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+	LOG_INFO << _jobs.size() << " tables in " << wall << " s";
+	for(size_t i=0; i<_nthreads; ++i)
+		LOG_INFO << "thread " << i << ": " << npoints[i] << " points, busy "
+				 << busy[i] << " s";
+}
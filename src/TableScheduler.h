@@ -0,0 +1,54 @@
+#ifndef TABLE_SCHEDULER_H
+#define TABLE_SCHEDULER_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+
+// Table generation broken into independent grid points, so that the points
+// of many tables can run on one pool of threads.
+class TableGenerator{
+public:
+	virtual ~TableGenerator(){}
+	// prepares the generation of shard k of nshards into fname, and returns
+	// the number of points left to compute
+	virtual size_t begin(std::string fname, size_t shard, size_t nshards) = 0;
+	// computes the k-th of them, safe to call concurrently
+	virtual void run(size_t k) = 0;
+	// saves the result, once all points have run
+	virtual void end(void) = 0;
+};
+
+// Runs a graph of table generations on a shared pool of threads.
+// A job starts once all the jobs it depends on have ended. Idle threads take
+// the next point of the earliest started job that still has points to hand
+// out, so the tail of one table overlaps with the next ones.
+class TableScheduler{
+private:
+	struct job{
+		TableGenerator * table;
+		std::string fname;
+		size_t shard, nshards;
+		size_t waiting; // number of unfinished dependencies
+		std::vector<size_t> dependents;
+		bool started;
+		size_t size, next, finished;
+	};
+	std::vector<job> _jobs;
+	size_t _nthreads, _ended;
+	std::mutex _lock;
+	std::condition_variable _ready;
+	void work(size_t & npoints, double & busy);
+	void end_job(size_t j, std::unique_lock<std::mutex> & guard);
+public:
+	// nthreads = 0 uses all hardware threads
+	TableScheduler(size_t nthreads=0);
+	// returns the id of the job, to be used in the "after" of later jobs
+	size_t add(TableGenerator * table, std::string fname,
+			std::vector<size_t> after=std::vector<size_t>(),
+			size_t shard=0, size_t nshards=1);
+	void run(void);
+};
+
+#endif
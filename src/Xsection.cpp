@@ -30,6 +30,10 @@ _f(f)
 	// Set Approximate function for X and dX_max
 	StochasticBase<2>::_ZeroMoment->SetApproximateFunction(approx_X22);
 	StochasticBase<2>::_FunctionMax->SetApproximateFunction(approx_dX22_max);
+	// inverse CDF of dX/dw at (sqrts, T)
+	if (StochasticBase<2>::_icdf > 0)
+		_ICDF = StochasticBase<2>::add_extra<3>("icdf",
+						{StochasticBase<2>::_icdf}, {0.}, {1.});
 }
 
 template<>
@@ -54,6 +58,12 @@ _f(f)
 	// Set Approximate function for X and dX_max
 	StochasticBase<3>::_ZeroMoment->SetApproximateFunction(approx_X23);
 	StochasticBase<3>::_FunctionMax->SetApproximateFunction(approx_dX23_max);
+	// VEGAS proposal of dX/dPS at (sqrts, T, delta_t)
+	if (StochasticBase<3>::_vegas > 0){
+		size_t n = 4*(StochasticBase<3>::_vegas+1);
+		_Vegas = StochasticBase<3>::add_extra<4>("vegas", {n}, {0.}, {n-1.});
+		_VegasMax = StochasticBase<3>::add_extra<3>("vegas-max", {}, {}, {});
+	}
 }
 
 template<>
@@ -78,6 +88,7 @@ _f(f)
 	// Set Approximate function for X and dX_max
 	//StochasticBase<4>::_ZeroMoment->SetApproximateFunction(approx_X32);
 	//StochasticBase<4>::_FunctionMax->SetApproximateFunction(approx_dX32_max);
+	StochasticBase<4>::add_envelope(2);
 }
 
 /*****************************************************************/
@@ -86,7 +97,7 @@ _f(f)
 /*------------------Implementation for 2 -> 2--------------------*/
 template<>
 void Xsection<2, double(*)(const double, void*)>::
-		sample(std::vector<double> parameters,
+		sample(const std::vector<double> & parameters,
 				std::vector< fourvec > & FS){
 	double sqrts = std::max(parameters[0], 1.4), temp = parameters[1];
 	double s = std::pow(sqrts,2);
@@ -102,7 +113,12 @@ void Xsection<2, double(*)(const double, void*)>::
 	double tmin = -std::pow(s-_mass*_mass, 2)/s, tmax=0.;
     double wmin = -std::log(1.-tmin/temp/temp),
 		   wmax = -std::log(1.-tmax/temp/temp);
-	double w = sample_1d(dXdw, {wmin, wmax}, StochasticBase<2>::GetFmax(parameters).s);
+	double w;
+	if (_ICDF){
+		double arg[3] = {sqrts, temp, icdf_fraction(Srandom::init_dis(Srandom::gen))};
+		w = wmin + (wmax-wmin)*_ICDF->InterpolateTable(arg).s;
+	}
+	else w = sample_1d(dXdw, {wmin, wmax}, StochasticBase<2>::GetFmax(parameters).s);
 	double t = temp*temp*(1.-std::exp(-w));
 	// sample phi
 	double phi = Srandom::dist_phi(Srandom::gen);
@@ -120,7 +136,7 @@ void Xsection<2, double(*)(const double, void*)>::
 /*------------------Implementation for 2 -> 3--------------------*/
 template<>
 void Xsection<3, double(*)(const double*, void*)>::
-	sample(std::vector<double> parameters,
+	sample(const std::vector<double> & parameters,
 			std::vector< fourvec > & FS){
 	double sqrts = std::max(parameters[0], 1.4), temp = parameters[1],
 		   delta_t = parameters[2];
@@ -130,7 +146,7 @@ void Xsection<3, double(*)(const double*, void*)>::
 	// x0 = log(1+kt/T), x1 = y/ymax, x2 = -log(1+(1-costheta34)/(T/Qmax)^2), c3 = phi34
 	double x2min = -std::log(1.+2./std::pow(temp/Qmax, 2)),
 		   x2max = 0.;
-	auto dXdPS = [s, temp, delta_t, Qmax, this](double * PS){
+	auto dXdPS = [s, temp, delta_t, Qmax, this](const double * PS){
 		double x2 = PS[2];
 		double x[4] = {PS[0], PS[1],
 				1.0 - (std::exp(-x2)-1.)*std::pow(temp/Qmax, 2), PS[3]};
@@ -140,13 +156,35 @@ void Xsection<3, double(*)(const double*, void*)>::
 		return this->_f(x, params)/2./(s-_mass*_mass)*Jacobian;
 	};
 
-	double xmin[4] = {0., -1.,  x2min, 0.};
-	double xmax[4] = {umax, 1., x2max, 2.*M_PI};
-	double fmax = StochasticBase<3>::GetFmax(parameters).s;
+	std::pair<double,double> range[4] = {{0., umax}, {-1., 1.},
+										 {x2min, x2max}, {0., 2.*M_PI}};
 	bool status = true;
-	auto res = sample_nd(dXdPS, 4, {{xmin[0], xmax[0]}, {xmin[1], xmax[1]},
-									{xmin[2], xmax[2]}, {xmin[3], xmax[3]}},
-									fmax, status);
+	double res[4];
+	if (_Vegas){
+		// the proposal blends those of the grid points around, with only
+		// the edges of the bins drawn blended, and the bound is the largest
+		// of theirs, as raised by this thread where it did not hold
+		size_t B = StochasticBase<3>::_vegas, n = 4*(B+1);
+		double arg[3] = {sqrts, temp, delta_t};
+		size_t index[8], cell;
+		double weight[8];
+		StochasticBase<3>::corners(arg, index, weight);
+		double w0 = StochasticBase<3>::corner_bound(*_VegasMax, arg, cell),
+			   wmax = w0;
+		auto edge = [this, &index, &weight, n, B](size_t d, size_t j){
+			double e = 0.;
+			for(size_t c=0; c<8; c++)
+				e += weight[c]*_Vegas->GetTableValue(index[c]*n + d*(B+1) + j).s;
+			return e;
+		};
+		sample_vegas(dXdPS, edge, B, range, 4, wmax, status, res);
+		if (wmax > w0) StochasticBase<3>::raise_bound(cell, wmax/w0);
+	}
+	// without a VEGAS proposal
+	else {
+		double fmax = StochasticBase<3>::GetFmax(parameters).s;
+		sample_nd(dXdPS, 4, range, fmax, status, res);
+	}
 	// deconvolve parameter
 	double kt = temp*(std::exp(res[0])-1.);
 	double yk = res[1]*std::acosh(Qmax/kt);
@@ -182,7 +220,7 @@ void Xsection<3, double(*)(const double*, void*)>::
 /*------------------Implementation for 3 -> 2--------------------*/
 template<>
 void Xsection<4, double(*)(const double*, void*)>::
-	sample(std::vector<double> parameters,
+	sample(const std::vector<double> & parameters,
 			std::vector< fourvec > & FS){
 	double sqrts = parameters[0], temp = parameters[1],
 		   xinel = parameters[2], yinel = parameters[3];
@@ -194,8 +232,13 @@ void Xsection<4, double(*)(const double*, void*)>::
 	};
 	double fmax = std::exp(StochasticBase<4>::GetFmax(parameters).s);
 	//LOG_INFO << "dX(sqrts, T, x, y, dt) " << sqrts << " " << temp << " " << xinel << " " << yinel << " " << dt;
+	static const std::pair<double,double> range[2] = {{-1., 1.}, {0., 2.*M_PI}};
 	bool status = true;
-	auto res = sample_nd(dXdPS, 2, {{-1., 1.}, {0., 2.*M_PI}}, fmax, status);
+	double res[2];
+	if (!sample_stratified(dXdPS, range, 2, StochasticBase<4>::_envelope,
+				StochasticBase<4>::envelope_cumulant(parameters.data()),
+				status, res))
+		sample_nd(dXdPS, 2, range, fmax, status, res);
 	/*if (status == false){
 		FS.resize(2);
 		double s12 = xinel*(s-_mass*_mass) + _mass*_mass;
@@ -482,6 +525,83 @@ tensor Xsection<2, double(*)(const double, void*)>::
 				  0., 	0., 		dptdpt/2.,	0.,
 				  0., 	0., 		0., 		dpzdpz};
 }
+/*****************************************************************/
+/*************************Sampled density of dX ******************/
+/*****************************************************************/
+/*------------------Default Implementation-----------------------*/
+template<size_t N, typename F>
+void Xsection<N, F>::sampled_density(std::vector<double>,
+			typename StochasticBase<N>::density &,
+			std::vector<std::pair<double,double>> &){
+}
+/*------------------Implementation for 3 -> 2--------------------*/
+template<>
+void Xsection<4, double(*)(const double*, void*)>::
+	sampled_density(std::vector<double> parameters, density & f,
+			std::vector<std::pair<double,double>> & range){
+	double sqrts = parameters[0], temp = parameters[1],
+		   xinel = parameters[2], yinel = parameters[3];
+	double s = sqrts*sqrts;
+	f = [s, temp, xinel, yinel, this](const double * PS){
+		double M = this->_mass;
+		double params[5] = {s, temp, M, xinel, yinel};
+		return this->_f(PS, params);
+	};
+	range = {{-1., 1.}, {0., 2.*M_PI}};
+}
+
+/*****************************************************************/
+/*************************Inverse CDF of dX **********************/
+/*****************************************************************/
+/*------------------Default Implementation-----------------------*/
+template<size_t N, typename F>
+Dvec Xsection<N, F>::calculate_extra(std::vector<double>){
+	return Dvec();
+}
+/*------------------Implementation for 2 -> 2--------------------*/
+template<>
+Dvec Xsection<2, double(*)(const double, void*)>::
+	calculate_extra(std::vector<double> parameters){
+	double s = std::pow(parameters[0],2), temp = parameters[1];
+	auto dXdw = [s, temp, this](double w) {
+        double T2 = temp*temp;
+		double params[3] = {s, temp, this->_mass};
+		double t = T2*(1.-std::exp(-w));
+		double Jacobian = T2 - t;
+		return this->_f(t, params)*Jacobian;
+	};
+	double tmin = -std::pow(s-_mass*_mass, 2)/s, tmax=0.;
+    double wmin = -std::log(1.-tmin/temp/temp),
+		   wmax = -std::log(1.-tmax/temp/temp);
+	return inverse_cdf(dXdw, {wmin, wmax}, StochasticBase<2>::_icdf);
+}
+/*------------------Implementation for 2 -> 3--------------------*/
+template<>
+Dvec Xsection<3, double(*)(const double*, void*)>::
+	calculate_extra(std::vector<double> parameters){
+	double sqrts = parameters[0], temp = parameters[1],
+		   delta_t = parameters[2];
+	double s = sqrts*sqrts;
+	double Qmax = (s-_mass*_mass)/2./sqrts;
+	double umax = std::log(1.+Qmax/temp);
+	// the same variables as the rejection sampling
+	double x2min = -std::log(1.+2./std::pow(temp/Qmax, 2)),
+		   x2max = 0.;
+	auto dXdPS = [s, temp, delta_t, Qmax, this](const double * PS){
+		double x2 = PS[2];
+		double x[4] = {PS[0], PS[1],
+				1.0 - (std::exp(-x2)-1.)*std::pow(temp/Qmax, 2), PS[3]};
+		double Jacobian = std::exp(-x2)*std::pow(temp/Qmax, 2);
+		double M = this->_mass;
+		double params[4] = {s, temp, M, delta_t};
+		return this->_f(x, params)/2./(s-_mass*_mass)*Jacobian;
+	};
+	double wmax;
+	auto res = vegas_grid(dXdPS, {{0., umax}, {-1., 1.}, {x2min, x2max},
+						{0., 2.*M_PI}}, StochasticBase<3>::_vegas, wmax);
+	res.push_back(wmax);
+	return res;
+}
 // instance:
 template class Xsection<2, double(*)(const double, void*)>;
 template class Xsection<3, double(*)(const double*, void*)>;
@@ -17,11 +17,21 @@ private:
 	scalar calculate_scalar(std::vector<double> parameters);
 	fourvec calculate_fourvec(std::vector<double> parameters);
 	tensor calculate_tensor(std::vector<double> parameters);
+	Dvec calculate_extra(std::vector<double> parameters);
+	void sampled_density(std::vector<double> parameters,
+				typename StochasticBase<N>::density & f,
+				std::vector<std::pair<double,double>> & range);
 	double _mass;
 	F _f;// the matrix element
+	// 2->2: fraction of [wmin, wmax] at each probability, w = -log(1-t/T^2)
+	std::shared_ptr<TableBase<scalar, 3>> _ICDF;
+	// 2->3: VEGAS edges of the 4 axes of the phase space, in a single extra
+	// dimension, and the bound of dX/q
+	std::shared_ptr<TableBase<scalar, 4>> _Vegas;
+	std::shared_ptr<TableBase<scalar, 3>> _VegasMax;
 public:
 	Xsection(std::string Name, std::string configfile, F f);
-	void sample(std::vector<double> arg, 
+	void sample(const std::vector<double> & arg, 
 						std::vector< fourvec > & FS);
 };
 
@@ -1,19 +1,19 @@
 #include "approx_functions.h"
 
 // Xsection
-scalar approx_X22(std::vector<double> params){
+scalar approx_X22(const double * params){
 	double sqrts = params[0];
 	double T = params[1];
 	return scalar{1.0/T/T};
 }
 
-scalar approx_dX22_max(std::vector<double> params){
+scalar approx_dX22_max(const double * params){
 	double sqrts = params[0];
 	double T = params[1];
 	return scalar{1.0/std::pow(T, 2)};
 }
 
-scalar approx_X23(std::vector<double> params){
+scalar approx_X23(const double * params){
 	double sqrts = params[0];
 	double T = params[1];
 	double delta_t = params[2];
@@ -21,7 +21,7 @@ scalar approx_X23(std::vector<double> params){
 	return scalar{a/(1.+a)/std::pow(T,3)};
 }
 
-scalar approx_dX23_max(std::vector<double> params){
+scalar approx_dX23_max(const double * params){
 	double sqrts = params[0];
 	double T = params[1];
 	double delta_t = params[2];
@@ -29,7 +29,7 @@ scalar approx_dX23_max(std::vector<double> params){
 	return scalar{a/(2.+a)/std::pow(T,4)};
 }
 
-scalar approx_X32(std::vector<double> params){
+scalar approx_X32(const double * params){
 	double sqrts = params[0];
 	double T = params[1];
 	double delta_t = params[4];
@@ -37,7 +37,7 @@ scalar approx_X32(std::vector<double> params){
 	return scalar{a/(1+a)/std::pow(T, 2)/sqrts};
 }
 
-scalar approx_dX32_max(std::vector<double> params){
+scalar approx_dX32_max(const double * params){
 	double sqrts = params[0];
 	double T = params[1];
 	double delta_t = params[4];
@@ -46,19 +46,19 @@ scalar approx_dX32_max(std::vector<double> params){
 }
 
 // Rate
-scalar approx_R22(std::vector<double> params){
+scalar approx_R22(const double * params){
 	double E = params[0];
 	double T = params[1];
 	return scalar{T};
 }
 
-scalar approx_dR22_max(std::vector<double> params){
+scalar approx_dR22_max(const double * params){
 	double E = params[0];
 	double T = params[1];
 	return scalar{T};
 }
 
-scalar approx_R23(std::vector<double> params){
+scalar approx_R23(const double * params){
 	double E = params[0];
 	double T = params[1];
 	double delta_t = params[2];
@@ -66,7 +66,7 @@ scalar approx_R23(std::vector<double> params){
 	return scalar{a/(a+5.)*T};
 }
 
-scalar approx_dR23_max(std::vector<double> params){
+scalar approx_dR23_max(const double * params){
 	double E = params[0];
 	double T = params[1];
 	double delta_t = params[2];
@@ -74,14 +74,14 @@ scalar approx_dR23_max(std::vector<double> params){
 	return scalar{a/(a+3.)*T};
 }
 
-scalar approx_R32(std::vector<double> params){
+scalar approx_R32(const double * params){
 	double E = params[0];
 	double T = params[1];
 	double delta_t = params[2];
 	return scalar{delta_t*std::pow(T,3)/E};
 }
 
-scalar approx_dR32_max(std::vector<double> params){
+scalar approx_dR32_max(const double * params){
 	double E = params[0];
 	double T = params[1];
 	double delta_t = params[2];
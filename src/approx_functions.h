@@ -4,17 +4,17 @@
 #include "lorentz.h"
 
 // Xsection
-scalar approx_X22(std::vector<double> params);
-scalar approx_dX22_max(std::vector<double> params);
-scalar approx_X23(std::vector<double> params);
-scalar approx_dX23_max(std::vector<double> params);
-scalar approx_X32(std::vector<double> params);
-scalar approx_dX32_max(std::vector<double> params);
+scalar approx_X22(const double * params);
+scalar approx_dX22_max(const double * params);
+scalar approx_X23(const double * params);
+scalar approx_dX23_max(const double * params);
+scalar approx_X32(const double * params);
+scalar approx_dX32_max(const double * params);
 // Rate
-scalar approx_R22(std::vector<double> params);
-scalar approx_dR22_max(std::vector<double> params);
-scalar approx_R23(std::vector<double> params);
-scalar approx_dR23_max(std::vector<double> params);
-scalar approx_R32(std::vector<double> params);
-scalar approx_dR32_max(std::vector<double> params);
+scalar approx_R22(const double * params);
+scalar approx_dR22_max(const double * params);
+scalar approx_R23(const double * params);
+scalar approx_dR23_max(const double * params);
+scalar approx_R32(const double * params);
+scalar approx_dR32_max(const double * params);
 #endif
@@ -14,7 +14,29 @@ void test_config(void);
 void test_table(void);
 
 
+void usage(void){
+	std::cout << "Distributed table generation, run in the folder of settings.xml:" << std::endl;
+	std::cout << "   $>./hybrid shard <process> <xsection|rate> <k> <M> <shard.h5> [mu]" << std::endl;
+	std::cout << "   $>./hybrid merge <process> <xsection|rate> <table.h5> <shard.h5> ..." << std::endl;
+	std::cout << "e.g. process = cq2cqg. Rate shards need the merged xsection in table.h5" << std::endl;
+}
+
 int main(int argc, char* argv[]){
+	std::string command = (argc > 1) ? argv[1] : "";
+	if (command == "shard"){
+		if (argc < 7) {usage(); return 1;}
+		size_t k = std::stoul(argv[4]), M = std::stoul(argv[5]);
+		double mu = (argc > 7) ? std::stod(argv[7]) : 1.0;
+		if (k >= M) {usage(); return 1;}
+		return generate_shard(argv[2], argv[3], k, M, argv[6],
+							  "./settings.xml", mu) ? 0 : 1;
+	}
+	if (command == "merge"){
+		if (argc < 6) {usage(); return 1;}
+		std::vector<std::string> shards(argv+5, argv+argc);
+		return merge_shards(argv[2], argv[3], shards, argv[4],
+							"./settings.xml", 1.0) ? 0 : 1;
+	}
 	probe_test(10, 0.3, 0.05, 100, 10000, "new");
 	return 0;
 }
@@ -38,6 +38,7 @@ template <typename T>
 void hdf5_add_scalar_attr(
   const H5::Group& gp, const std::string& name, const T& value) {
   const auto& datatype = type<T>();
+  if (gp.attrExists(name.c_str())) gp.removeAttr(name.c_str());
   auto attr = gp.createAttribute(name.c_str(), datatype, H5::DataSpace{});
   attr.write(datatype, &value);
 }
@@ -1,12 +1,28 @@
 #include "random.h"
+#include <cmath>
 
 namespace Srandom{
 const double AMC = 4.0;
-std::mt19937 gen(std::random_device{}());
-std::uniform_real_distribution<double> sqrtZ(std::sqrt(1./AMC), std::sqrt(AMC));
-std::uniform_real_distribution<double> rejection(0.0, 1.0);
-std::uniform_real_distribution<double> init_dis(0.0, 1.0);
-std::uniform_real_distribution<double> dist_phi(0.0, 2.0*M_PI);
-std::uniform_real_distribution<double> dist_costheta(-1.0, 1.0);
-std::normal_distribution<double> white_noise(0.0, 1.0);
+// master seed of all the per-thread substreams
+unsigned master_seed = std::random_device{}();
+thread_local std::mt19937 gen(std::random_device{}());
+thread_local std::uniform_real_distribution<double> sqrtZ(std::sqrt(1./AMC), std::sqrt(AMC));
+thread_local std::uniform_real_distribution<double> rejection(0.0, 1.0);
+thread_local std::uniform_real_distribution<double> init_dis(0.0, 1.0);
+thread_local std::uniform_real_distribution<double> dist_phi(0.0, 2.0*M_PI);
+thread_local std::uniform_real_distribution<double> dist_costheta(-1.0, 1.0);
+thread_local std::normal_distribution<double> white_noise(0.0, 1.0);
+
+// set the master seed, and reseed the calling thread as stream 0
+void set_seed(unsigned seed){
+	master_seed = seed;
+	set_stream(0);
+}
+
+// reseed the calling thread with substream (stream, substream) of the master seed
+void set_stream(unsigned stream, unsigned substream){
+	std::seed_seq seq{master_seed, stream, substream};
+	gen.seed(seq);
+	white_noise.reset();
+}
 }
@@ -2,13 +2,19 @@
 #define RANDOM_H
 #include <random>
 
+// Each thread owns its engine and distributions, so the samplers can be
+// called concurrently. A thread starts from a random_device seed; a worker
+// that calls set_stream(i) after set_seed(s) gets a reproducible stream
+// that depends only on (s, i); a second index j gives the stream (s, i, j).
 namespace Srandom{
-extern std::mt19937 gen;
-extern std::uniform_real_distribution<double> sqrtZ;
-extern std::uniform_real_distribution<double> rejection;
-extern std::uniform_real_distribution<double> init_dis;
-extern std::uniform_real_distribution<double> dist_phi;
-extern std::uniform_real_distribution<double> dist_costheta;
-extern std::normal_distribution<double> white_noise;
+extern thread_local std::mt19937 gen;
+extern thread_local std::uniform_real_distribution<double> sqrtZ;
+extern thread_local std::uniform_real_distribution<double> rejection;
+extern thread_local std::uniform_real_distribution<double> init_dis;
+extern thread_local std::uniform_real_distribution<double> dist_phi;
+extern thread_local std::uniform_real_distribution<double> dist_costheta;
+extern thread_local std::normal_distribution<double> white_noise;
+void set_seed(unsigned seed);
+void set_stream(unsigned stream, unsigned substream=0);
 }
 #endif
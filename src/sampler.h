@@ -6,6 +6,9 @@
 #include <functional>
 #include <memory>
 #include <utility>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 #include "random.h"
 #include "simpleLogger.h"
 #include "stat.h"
@@ -27,18 +30,19 @@ double sample_1d(F f, std::pair<double,double> const& range, double fmax){
 	return x;
 }
 
+// without heap allocation, range points to dim pairs and the point is
+// written to x
 template < typename F >
-std::vector<double> sample_nd(F f, int dim, std::vector<std::pair<double,double>> const& range, double fmax, bool & status){
+void sample_nd(F f, int dim, const std::pair<double,double> * range,
+				double fmax, bool & status, double * x){
 	int limit = 50000;
-	double * x = new double[dim];
   	double y;
-  	double * interval = new double[dim];
 	int counter = 0;
-	for(int i=0; i<dim; i++) interval[i] = range[i].second - range[i].first;
 	do{
 		// random choice
-		for(int i=0; i<dim; i++) 
-			x[i] = range[i].first+Srandom::init_dis(Srandom::gen)*interval[i];
+		for(int i=0; i<dim; i++)
+			x[i] = range[i].first + Srandom::init_dis(Srandom::gen)
+								   *(range[i].second - range[i].first);
 		y = f(x)/fmax;
 		if (y > 1.0) {
 			LOG_WARNING << "nd rejection, f/fmax = " << y << " > 1";
@@ -46,18 +50,304 @@ std::vector<double> sample_nd(F f, int dim, std::vector<std::pair<double,double>
 		}
 		counter ++;
 	}while(Srandom::rejection(Srandom::gen)>y && counter < limit);
-	std::vector<double> res(dim);
-	for(int i=0; i<dim; i++) res[i] = x[i];
-	delete[] x;
-	delete[] interval;
 	if(counter==limit) {
 		LOG_WARNING <<  "nd rejection, too many tries = " << limit;
 		status = false;
 	}
 	SamplerStat::count_nd ++; SamplerStat::total_nd += counter;
+}
+
+template < typename F >
+std::vector<double> sample_nd(F f, int dim, std::vector<std::pair<double,double>> const& range, double fmax, bool & status){
+	std::vector<double> res(dim);
+	sample_nd(f, dim, range.data(), fmax, status, res.data());
+	return res;
+}
+
+// The probability at the fraction u of the probability axis of an inverse
+// CDF table, and the fraction of a probability p. The knots are denser at
+// both ends, so that the tails, where f changes the fastest relative to
+// itself, are not spread flat over a wide interval.
+inline double icdf_probability(double u){return .5*(1. - std::cos(M_PI*u));}
+inline double icdf_fraction(double p){return std::acos(1. - 2.*p)/M_PI;}
+
+// Inverse of the cumulative distribution of f over range at the K
+// probabilities icdf_probability(j/(K-1)), as fractions of the range, from a
+// trapezoid sum of f over n intervals. Interpolating them linearly in
+// icdf_fraction(p) of a uniform p samples f without rejection; f <= 0
+// everywhere gives a flat distribution.
+template < typename F >
+std::vector<double> inverse_cdf(F f, std::pair<double,double> const& range,
+								size_t K, size_t n=1000){
+	double dx = (range.second - range.first)/n;
+	std::vector<double> cdf(n+1, 0.), res(K);
+	double f0 = std::max(f(range.first), 0.);
+	for(size_t i=1; i<=n; i++){
+		double f1 = std::max(f(range.first + i*dx), 0.);
+		cdf[i] = cdf[i-1] + .5*(f0 + f1);
+		f0 = f1;
+	}
+	for(size_t j=0; j<K; j++) res[j] = icdf_probability(double(j)/(K-1));
+	if (cdf[n] <= 0.) return res;
+	size_t i = 0;
+	for(size_t j=1; j+1<K; j++){
+		double c = res[j]*cdf[n];
+		while (cdf[i+1] < c) i++;
+		double dc = cdf[i+1] - cdf[i];
+		res[j] = (i + (dc > 0. ? (c - cdf[i])/dc : 0.))/n;
+	}
 	return res;
 }
 
+// ----------VEGAS-style proposal---------------------------------
+// Each axis of the box range is cut into B bins of equal probability, with
+// edges given as fractions of the range, edge(d, j) for j = 0..B on axis d.
+// Draws a point x and returns its weight 1/q, q being the density of the
+// proposal relative to the uniform one; bin[d] receives its bins if given.
+template < typename E >
+inline double vegas_point(E edge, size_t B, const std::pair<double,double> * range,
+			size_t dim, double * x, size_t * bin=nullptr){
+	double weight = 1.;
+	for(size_t d=0; d<dim; d++){
+		double r = Srandom::init_dis(Srandom::gen)*B;
+		size_t b = std::min(size_t(r), B-1);
+		double e0 = edge(d, b), width = edge(d, b+1) - e0;
+		x[d] = range[d].first
+			 + (e0 + (r-b)*width)*(range[d].second - range[d].first);
+		weight *= B*width;
+		if (bin) bin[d] = b;
+	}
+	return weight;
+}
+
+// moves the edges e of one axis so that each bin gets the same share of the
+// accumulated squared weights d, smoothed and damped as in VEGAS
+inline void vegas_rebin(double * e, const double * d, size_t B){
+	std::vector<double> m(B), edges(B+1);
+	double sum = 0.;
+	for(size_t b=0; b<B; b++){
+		m[b] = (d[b>0?b-1:b] + d[b] + d[b+1<B?b+1:b])/3.;
+		sum += m[b];
+	}
+	if (sum <= 0.) return;
+	double total = 0.;
+	for(size_t b=0; b<B; b++){
+		double r = m[b]/sum;
+		m[b] = (r <= 0.) ? 0. : ((r >= 1.) ? 1. : std::pow((r-1.)/std::log(r), 0.5));
+		total += m[b];
+	}
+	// a floor, so that no part of the range is left out
+	for(size_t b=0; b<B; b++) m[b] += 1e-2*total/B;
+	total *= 1. + 1e-2;
+	edges[0] = 0.; edges[B] = 1.;
+	size_t b = 0;
+	double acc = 0.;
+	for(size_t j=1; j<B; j++){
+		double target = total*j/B;
+		while (acc + m[b] < target && b+1 < B) acc += m[b++];
+		edges[j] = e[b] + std::min((target-acc)/m[b], 1.)*(e[b+1]-e[b]);
+	}
+	for(size_t j=0; j<=B; j++) e[j] = edges[j];
+}
+
+// adapts the VEGAS edges of f over range in niter rounds of npoints draws,
+// and returns them with wmax, the bound of f/q over the final proposal.
+// Within a bin q is constant, so the bound is taken like the envelope
+// maxima: from the edges and midpoints of the bins of each axis, an edge
+// with the larger weight of its two bins, and saved 1.5 times larger.
+template < typename F >
+std::vector<double> vegas_grid(F f, std::vector<std::pair<double,double>> const& range,
+			size_t B, double & wmax, size_t niter=5, size_t npoints=2000){
+	size_t dim = range.size();
+	std::vector<double> edges(dim*(B+1)), d(dim*B), x(dim);
+	std::vector<size_t> bin(dim);
+	for(size_t i=0; i<dim; i++)
+		for(size_t b=0; b<=B; b++) edges[i*(B+1)+b] = double(b)/B;
+	auto edge = [&edges, B](size_t i, size_t j){return edges[i*(B+1)+j];};
+	for(size_t it=0; it<niter; it++){
+		std::fill(d.begin(), d.end(), 0.);
+		for(size_t n=0; n<npoints; n++){
+			double weight = vegas_point(edge, B, range.data(), dim, x.data(), bin.data());
+			double fw = std::abs(f(x.data()))*weight;
+			for(size_t i=0; i<dim; i++) d[i*B+bin[i]] += fw*fw;
+		}
+		for(size_t i=0; i<dim; i++)
+			vegas_rebin(edges.data()+i*(B+1), d.data()+i*B, B);
+	}
+	size_t L = 2*B+1, nnodes = 1;
+	for(size_t i=0; i<dim; i++) nnodes *= L;
+	wmax = 0.;
+	for(size_t n=0; n<nnodes; n++){
+		size_t q = n;
+		double weight = 1.;
+		for(int i=dim-1; i>=0; i--){
+			size_t k = q%L, b = k/2;
+			q /= L;
+			const double * e = edges.data() + i*(B+1);
+			double u, width;
+			if (k%2){
+				u = .5*(e[b] + e[b+1]);
+				width = e[b+1] - e[b];
+			}
+			else{
+				u = e[b];
+				width = std::max(b > 0 ? e[b] - e[b-1] : 0., b < B ? e[b+1] - e[b] : 0.);
+			}
+			x[i] = range[i].first + u*(range[i].second - range[i].first);
+			weight *= B*width;
+		}
+		// a NaN or infinity at the edge of the range is left out
+		double y = std::abs(f(x.data()))*weight;
+		if (std::isfinite(y)) wmax = std::max(wmax, y);
+	}
+	wmax *= 1.5;
+	return edges;
+}
+
+// rejection sampling of f from the VEGAS proposal of edge(d, j), accepted
+// with f/(q*wmax), the point goes to x. A point above wmax raises it to 1.5
+// times f/q, and the draw starts over; the point is counted in
+// SamplerStat::overflow_nd, and the caller may keep the raised wmax for
+// its later draws. status is false after too many tries.
+template < typename F, typename E >
+void sample_vegas(F f, E edge, size_t B, const std::pair<double,double> * range,
+			size_t dim, double & wmax, bool & status, double * x){
+	int limit = 50000;
+	double y;
+	int counter = 0;
+	do{
+		double weight = vegas_point(edge, B, range, dim, x);
+		double fw = f(x)*weight;
+		y = fw/wmax;
+		counter ++;
+		if (y > 1.0) {
+			LOG_WARNING << "vegas rejection, f/(q*wmax) = " << y << " > 1, raised";
+			SamplerStat::overflow_nd ++;
+			wmax = 1.5*fw;
+			y = 0.;
+		}
+	}while(Srandom::rejection(Srandom::gen)>y && counter < limit);
+	if(counter==limit) {
+		LOG_WARNING <<  "vegas rejection, too many tries = " << limit;
+		status = false;
+	}
+	SamplerStat::count_nd ++; SamplerStat::total_nd += counter;
+}
+
+// ----------Piecewise constant envelope---------------------------
+// Maxima of f over the S^dim sub-boxes of range (row-major, the first axis
+// the slowest), from the corners and midpoints of each, i.e. a lattice of
+// 2S+1 points per axis. Saved 1.5 times larger like fmax, and at least 1e-3
+// of the largest, so that no sub-box is left out.
+template < typename F >
+std::vector<double> envelope_maxima(F f, std::vector<std::pair<double,double>> const& range,
+			size_t S){
+	size_t dim = range.size(), L = 2*S+1, nboxes = 1, nnodes = 1;
+	for(size_t i=0; i<dim; i++) {nboxes *= S; nnodes *= L;}
+	std::vector<double> maxima(nboxes, 0.), x(dim);
+	std::vector<size_t> node(dim), first(dim), count(dim), box(dim);
+	for(size_t n=0; n<nnodes; n++){
+		size_t q = n;
+		for(int i=dim-1; i>=0; i--){
+			node[i] = q%L; q /= L;
+			x[i] = range[i].first
+				 + (range[i].second - range[i].first)*node[i]/(2.*S);
+			// an even node is on the edge of two sub-boxes
+			first[i] = (node[i] == 0) ? 0 : (node[i]-1)/2;
+			count[i] = (node[i]%2 == 0 && node[i] > 0 && node[i] < 2*S) ? 2 : 1;
+		}
+		// so that a NaN at the edge of the range counts as 0
+		double y = f(x.data());
+		if (!(y > 0.)) y = 0.;
+		// every sub-box that has this node
+		size_t ncombos = 1;
+		for(size_t i=0; i<dim; i++) ncombos *= count[i];
+		for(size_t c=0; c<ncombos; c++){
+			size_t r = c, b = 0;
+			for(size_t i=0; i<dim; i++){
+				b = b*S + first[i] + r%count[i];
+				r /= count[i];
+			}
+			maxima[b] = std::max(maxima[b], y);
+		}
+	}
+	double largest = *std::max_element(maxima.begin(), maxima.end());
+	for(auto & m : maxima) m = 1.5*std::max(m, 1e-3*largest);
+	return maxima;
+}
+
+// rejection sampling of f from a piecewise constant envelope over the S^dim
+// sub-boxes of range (row-major, the first axis the slowest), given by the
+// cumulative sums of its sub-box maxima: a sub-box is picked with a
+// probability proportional to its maximum, and a uniform point in it, put
+// in x, is kept with f/maximum. A point above its maximum raises it to 1.5
+// times f, and the draw starts over; the thread keeps the raised envelope
+// of that cell for its later draws, and counts the point in
+// SamplerStat::overflow_nd. It returns false, for the caller to use another
+// sampler, only without an envelope. status is false after too many tries.
+template < typename F >
+bool sample_stratified(F f, const std::pair<double,double> * range, size_t dim,
+			size_t S, const double * cumulant, bool & status, double * x){
+	if (!cumulant) return false;
+	size_t nboxes = 1;
+	for(size_t i=0; i<dim; i++) nboxes *= S;
+	double total = cumulant[nboxes-1];
+	if (!(total > 0.)) return false;
+	// the raised envelopes of the thread, by the cumulant of their cell; with
+	// its total as tabulated, so that a table loaded since then is not taken
+	// for the one they were raised on
+	struct raised_cell{ double total; std::vector<double> cumulant; };
+	static thread_local std::unordered_map<const double *, raised_cell> raised;
+	const double * cell = cumulant;
+	if (!raised.empty()){
+		auto it = raised.find(cell);
+		if (it != raised.end()){
+			if (it->second.total == total) cumulant = it->second.cumulant.data();
+			else raised.erase(it);
+		}
+	}
+	total = cumulant[nboxes-1];
+	int limit = 50000;
+	double y;
+	int counter = 0;
+	do{
+		double u = Srandom::init_dis(Srandom::gen)*total;
+		size_t b = std::min(size_t(std::upper_bound(cumulant, cumulant+nboxes, u)
+								- cumulant), nboxes-1);
+		double ymax = cumulant[b] - (b > 0 ? cumulant[b-1] : 0.);
+		size_t box = b;
+		for(int i=dim-1; i>=0; i--){
+			double width = (range[i].second - range[i].first)/S;
+			x[i] = range[i].first
+				 + width*(b%S + Srandom::init_dis(Srandom::gen));
+			b /= S;
+		}
+		double fx = f(x);
+		y = fx/ymax;
+		counter ++;
+		if (y > 1.0) {
+			LOG_WARNING << "stratified rejection, f/max = " << y
+						<< " > 1, raised";
+			SamplerStat::overflow_nd ++;
+			auto & R = raised[cell];
+			if (R.cumulant.empty()){
+				R.total = cell[nboxes-1];
+				R.cumulant.assign(cell, cell+nboxes);
+			}
+			for(size_t c=box; c<nboxes; c++) R.cumulant[c] += 1.5*fx - ymax;
+			cumulant = R.cumulant.data();
+			total = cumulant[nboxes-1];
+			y = 0.;
+		}
+	}while(Srandom::rejection(Srandom::gen)>y && counter < limit);
+	if(counter==limit) {
+		LOG_WARNING <<  "stratified rejection, too many tries = " << limit;
+		status = false;
+	}
+	SamplerStat::count_nd ++; SamplerStat::total_nd += counter;
+	return true;
+}
+
 // ----------Affine-invariant metropolis sample-------------------
 struct walker{
 	double * posi;
@@ -70,6 +360,7 @@ private:
 	F f;
 	size_t n_dims, Nwalker;
 	std::vector<walker> walkers, buff_walkers;
+	std::uniform_int_distribution<size_t> pick_walker;
 	double maxP;
 	std::vector<double> maxloc;
 	
@@ -95,7 +386,7 @@ private:
 		walker w, wr;
 		for (size_t i=0; i<Nwalker; ++i){
 			do{ 
-				ri = std::rand() % Nwalker;
+				ri = pick_walker(Srandom::gen);
 			}while(i==ri);
 			w = walkers[i];
 			wr = walkers[ri];
@@ -128,7 +419,8 @@ private:
 	}
 
 public:
-	AiMS(F f_, int n_dims_): f(f_), n_dims(n_dims_), Nwalker(n_dims*4){
+	AiMS(F f_, int n_dims_): f(f_), n_dims(n_dims_), Nwalker(n_dims*4),
+	pick_walker(0, n_dims*4-1){
 		maxloc.resize(n_dims);
 		walkers.resize(Nwalker); 
 		buff_walkers.resize(Nwalker);
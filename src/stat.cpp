@@ -1,5 +1,6 @@
 #include "stat.h"
-int SamplerStat::count_1d = 0;
-int SamplerStat::count_nd = 0;
-int SamplerStat::total_1d = 0;
-int SamplerStat::total_nd = 0;
+std::atomic<int> SamplerStat::count_1d(0);
+std::atomic<int> SamplerStat::count_nd(0);
+std::atomic<int> SamplerStat::total_1d(0);
+std::atomic<int> SamplerStat::total_nd(0);
+std::atomic<int> SamplerStat::overflow_nd(0);
@@ -1,13 +1,17 @@
 #ifndef STAT_H
 #define STAT_H
+#include <atomic>
 
+// shared by all sampling threads, hence atomic
 class SamplerStat{
 public:
 	SamplerStat(){}
-	static int count_1d;
-	static int count_nd;
-	static int total_1d;
-	static int total_nd;
+	static std::atomic<int> count_1d;
+	static std::atomic<int> count_nd;
+	static std::atomic<int> total_1d;
+	static std::atomic<int> total_nd;
+	// points found above the bound of a sampler that raises it instead
+	static std::atomic<int> overflow_nd;
 };
 
 #endif
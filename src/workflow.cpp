@@ -9,157 +9,470 @@
 #include <boost/any.hpp>
 #include <boost/foreach.hpp>
 #include "logo.h"
+#include "TableRegistry.h"
+#include "approx_functions.h"
 
 std::map<int, std::vector<Process> > AllProcesses;
+// charm and bottom
+Species AllSpecies[2];
+// most channels a species can have
+const size_t max_channels = 8;
 
-void init_process(Process& r, std::string mode){
-     switch(r.which()){
-                        case 0:
-                                if (boost::get<Rate22>(r).IsActive())
-                                        if(mode == "new"){
-                                                boost::get<Rate22>(r).initX("table.h5");
-                                                boost::get<Rate22>(r).init("table.h5");
-                                        } else{
-                                                boost::get<Rate22>(r).loadX("table.h5");
-                                                boost::get<Rate22>(r).load("table.h5");
-                                        }
-                                else return;
-                                break;
-                        case 1:
-                                if (boost::get<Rate23>(r).IsActive())
-                                        if(mode == "new"){
-                                                boost::get<Rate23>(r).initX("table.h5");
-                                                boost::get<Rate23>(r).init("table.h5");
-                                        } else{
-                                                boost::get<Rate23>(r).loadX("table.h5");
-                                                boost::get<Rate23>(r).load("table.h5");
-                                        }
-                                else return;
-                                break;
-						case 2:
-								if (boost::get<Rate32>(r).IsActive())
-										if(mode == "new"){
-												boost::get<Rate32>(r).initX("table.h5");
-												boost::get<Rate32>(r).init("table.h5");
-										} else{
-												boost::get<Rate32>(r).loadX("table.h5");
-												boost::get<Rate32>(r).load("table.h5");
-										}
-								else return;
-								break;
-                        default:
-                                exit(-1);
-                                break;
-                }
+inline Species & species(int absid){
+	if (absid != 4 && absid != 5) {
+		LOG_FATAL << "no process for pid = " << absid;
+		exit(-1);
+	}
+	return AllSpecies[absid-4];
+}
+
+boost::property_tree::ptree read_settings(std::string path){
+	boost::property_tree::ptree config;
+	std::ifstream input(path);
+	read_xml(input, config);
+	return config;
+}
+
+// inactive processes are not constructed, but hold their channel number
+template <typename R, typename F>
+void add_process(std::vector<Process> & processes,
+		const boost::property_tree::ptree & config,
+		std::string name, std::string path, F f){
+	auto key = boost::replace_all_copy(name, "/", ".")+".<xmlattr>.status";
+	if (config.get<std::string>(key, "") == "active")
+		processes.push_back( R(name, path, f) );
+	else
+		processes.push_back( Inactive{name} );
 }
 
+void build_processes(std::string path){
+	auto config = read_settings(path);
+	auto & c = AllProcesses[4];
+	c = std::vector<Process>();
+	add_process<Rate22>(c, config, "Boltzmann/cq2cq", path, dX_Qq2Qq_dt);
+	add_process<Rate22>(c, config, "Boltzmann/cg2cg", path, dX_Qg2Qg_dt);
+	add_process<Rate23>(c, config, "Boltzmann/cq2cqg", path, M2_Qq2Qqg);
+	add_process<Rate23>(c, config, "Boltzmann/cg2cgg", path, M2_Qg2Qgg);
+	add_process<Rate32>(c, config, "Boltzmann/cqg2cq", path, Ker_Qqg2Qq);
+	add_process<Rate32>(c, config, "Boltzmann/cgg2cg", path, Ker_Qgg2Qg);
+
+	auto & b = AllProcesses[5];
+	b = std::vector<Process>();
+	add_process<Rate22>(b, config, "Boltzmann/bq2bq", path, dX_Qq2Qq_dt);
+	add_process<Rate22>(b, config, "Boltzmann/bg2bg", path, dX_Qg2Qg_dt);
+	add_process<Rate23>(b, config, "Boltzmann/bq2bqg", path, M2_Qq2Qqg);
+	add_process<Rate23>(b, config, "Boltzmann/bg2bgg", path, M2_Qg2Qgg);
+	add_process<Rate32>(b, config, "Boltzmann/bqg2bq", path, Ker_Qqg2Qq);
+	add_process<Rate32>(b, config, "Boltzmann/bgg2bg", path, Ker_Qgg2Qg);
+}
+
+// registers the loading of the xsection and rate tables of a process
+struct register_tables: public boost::static_visitor<void>{
+	TableRegistry & registry;
+	register_tables(TableRegistry & registry_): registry(registry_){}
+	template <typename R>
+	void operator()(R & r) const {
+		if (!r.IsActive()) return;
+		R * p = &r;
+		registry.add(r.NameX(), [p](H5::H5File & file){return p->loadX(file);});
+		registry.add(r.Name(), [p](H5::H5File & file){return p->load(file);});
+	}
+	void operator()(Inactive &) const {}
+};
+
+// adds the xsection and then the rate table of a process to the build graph,
+// unless it has been loaded already; a table missing from the file resumes
+// from its checkpoint if there is one
+struct schedule_tables: public boost::static_visitor<void>{
+	TableScheduler & scheduler;
+	const TableRegistry & registry;
+	std::string fname;
+	schedule_tables(TableScheduler & scheduler_,
+					const TableRegistry & registry_, std::string fname_):
+	scheduler(scheduler_), registry(registry_), fname(fname_){}
+	template <typename R>
+	void operator()(R & r) const {
+		if (!r.IsActive()) return;
+		std::vector<size_t> after;
+		if (!registry.loaded(r.NameX()))
+			after.push_back( scheduler.add(r.generatorX(), fname) );
+		if (!registry.loaded(r.Name()))
+			scheduler.add(&r, fname, after);
+	}
+	void operator()(Inactive &) const {}
+};
+
+struct process_name: public boost::static_visitor<std::string>{
+	template <typename R>
+	std::string operator()(R & r) const {return r.Name();}
+};
+
+// rate of one channel at x = (E, T, dt23, dt32) in the cell frame, in the
+// component of its type in the fused table
+struct channel_rate: public boost::static_visitor<fourvec>{
+	const double * x;
+	channel_rate(const double * x_): x(x_){}
+	fourvec operator()(Rate22 & r) const {
+		return fourvec{r.IsActive() ? r.GetZeroM(x).s : 0., 0., 0., 0.};
+	}
+	fourvec operator()(Rate23 & r) const {
+		double arg[3] = {x[0], x[1], x[2]};
+		return fourvec{0., r.IsActive() ? r.GetZeroM(arg).s : 0., 0., 0.};
+	}
+	fourvec operator()(Rate32 & r) const {
+		double arg[3] = {x[0], x[1], x[3]};
+		return fourvec{0., 0., r.IsActive() ? r.GetZeroM(arg).s : 0., 0.};
+	}
+	fourvec operator()(Inactive &) const {return fourvec{0., 0., 0., 0.};}
+};
+
+// the approximants of the tables of the 2->2, 2->3 and 3->2 rates at
+// x = (E, T, dt23, dt32), for the components of the fused table; the 3->2
+// rates have none. They grow with T and dt23, and do not depend on E.
+fourvec approx_total(const double * x){
+	return fourvec{approx_R22(x).s, approx_R23(x).s, 1., 1.};
+}
+
+fourvec max_components(const fourvec & A, const fourvec & B){
+	return fourvec{std::max(A.t(), B.t()), std::max(A.x(), B.x()),
+				   std::max(A.y(), B.y()), std::max(A.z(), B.z())};
+}
+
+// collects the active channels of a species by type
+struct add_channel: public boost::static_visitor<void>{
+	Species & S;
+	int id;
+	add_channel(Species & S_, int id_): S(S_), id(id_){}
+	template <typename R>
+	void push(Channels<R> & C, R & r) const {
+		if (!r.IsActive()) return;
+		C.rates.push_back(&r);
+		C.ids.push_back(id);
+	}
+	void operator()(Rate22 & r) const {push(S.r22, r);}
+	void operator()(Rate23 & r) const {push(S.r23, r);}
+	void operator()(Rate32 & r) const {push(S.r32, r);}
+	void operator()(Inactive &) const {}
+};
+
+// Resolves the active channels of each species, and sums their rates into
+// one table over (E, T, dt23, dt32), so that most steps, where nothing
+// happens, cost a single lookup. The grid covers the rate grids of the active channels with
+// the finest number of points of each; a formation time no active channel
+// depends on gets a dummy dimension of 2 points, away from 0 where the
+// approximant of 2->3 vanishes. The 2->2, 2->3 and 3->2 rates are summed
+// apart, so that each is interpolated over the approximant of its
+// channels, as in their own tables: the 2->3 rates go as dt23^2 at small
+// dt23, which a single approximant in T leaves to a linear interpolation.
+void build_species(const boost::property_tree::ptree & config){
+	for(auto & it : AllProcesses){
+		Species & S = species(it.first);
+		S = Species();
+		for(size_t i=0; i<it.second.size(); ++i)
+			boost::apply_visitor(add_channel(S, i), it.second[i]);
+		if (S.r22.size() + S.r23.size() + S.r32.size() > max_channels) {
+			LOG_FATAL << "more than " << max_channels << " channels";
+			exit(-1);
+		}
+		Svec shape(4, 2);
+		Dvec low(4, 1e10), high(4, -1e10);
+		for(auto & r : it.second){
+			if (r.which() > 2) continue;
+			std::vector<std::string> strs, slots;
+			auto name = boost::apply_visitor(process_name(), r);
+			boost::split(strs, name, boost::is_any_of("/"));
+			auto tree = config.get_child(strs[0]+"."+strs[1]+".rate");
+			std::string allslots = tree.get<std::string>("<xmlattr>.slots");
+			boost::split(slots, allslots, boost::is_any_of(","));
+			for(size_t i=0; i<slots.size(); ++i){
+				// energy, temp, then the formation time of 2->3 or 3->2
+				size_t d = (i < 2) ? i : r.which()+1;
+				shape[d] = std::max(shape[d], tree.get<size_t>("N"+slots[i]));
+				low[d] = std::min(low[d], tree.get<double>("L"+slots[i]));
+				high[d] = std::max(high[d], tree.get<double>("H"+slots[i]));
+			}
+		}
+		for(size_t d=0; d<4; ++d)
+			if (low[d] > high[d]) {low[d] = 1.; high[d] = 2.;}
+		std::string species = (it.first == 4) ? "c" : "b";
+		auto total = std::make_shared<TableBase<fourvec, 4>>(
+						"Boltzmann/"+species+"/total", shape, low, high);
+		total->SetApproximateFunction(approx_total);
+		for(size_t d=0; d<4; ++d){
+			S.low[d] = low[d];
+			S.step[d] = (high[d]-low[d])/(shape[d]-1);
+			S.shape[d] = shape[d];
+		}
+		S.max_rate.assign(shape[0]*shape[1], fourvec{0., 0., 0., 0.});
+		Svec index(4);
+		for(size_t i=0; i<total->length(); ++i){
+			size_t q = i;
+			for(int d=3; d>=0; --d){
+				index[d] = q%shape[d];
+				q /= shape[d];
+			}
+			Dvec x = total->parameters(index);
+			channel_rate rate(x.data());
+			fourvec sum{0., 0., 0., 0.};
+			for(auto & r : it.second) sum = sum + boost::apply_visitor(rate, r);
+			total->SetTableValue(index, sum);
+			auto & m = S.max_rate[index[0]*shape[1]+index[1]];
+			m = max_components(m, sum/approx_total(x.data()));
+		}
+		S.total = total;
+	}
+}
 
 void initialize(std::string mode, std::string path, double mu){
 	print_logo();
-	boost::property_tree::ptree config;
     initialize_mD_and_scale(1, mu);
+	build_processes(path);
+	auto config = read_settings(path);
+	size_t nthreads = config.get<size_t>("Boltzmann.<xmlattr>.threads", 0);
+	// in "old" mode, all the tables are read from one open file in parallel
+	TableRegistry registry("table.h5", nthreads);
+	if (mode == "old"){
+		register_tables add(registry);
+		BOOST_FOREACH(Process& r, AllProcesses[4]) boost::apply_visitor(add, r);
+		BOOST_FOREACH(Process& r, AllProcesses[5]) boost::apply_visitor(add, r);
+		registry.load();
+	}
+	// the missing tables go to one pool of threads, a rate table only
+	// waits for its own xsection table
+	TableScheduler scheduler(nthreads);
+	schedule_tables schedule(scheduler, registry, "table.h5");
+	BOOST_FOREACH(Process& r, AllProcesses[4]) boost::apply_visitor(schedule, r);
+	BOOST_FOREACH(Process& r, AllProcesses[5]) boost::apply_visitor(schedule, r);
+	scheduler.run();
+	build_species(config);
+}
+
+// generates / merges the xsection or rate table of a single process
+struct table_task: public boost::static_visitor<bool>{
+	std::string quantity, fname;
+	size_t shard, nshards;
+	std::vector<std::string> shards;
+	template <typename R>
+	bool operator()(R & r) const {
+		if (!shards.empty()){
+			if (quantity == "xsection") return r.mergeX(shards, fname);
+			else return r.merge(shards, fname);
+		}
+		if (quantity == "xsection") {
+			r.initX_shard(fname, shard, nshards);
+			return true;
+		}
+		// the rate is an integral over the full xsection table
+		if (!r.loadX("table.h5")) {
+			LOG_ERROR << "the xsection table must be in table.h5";
+			return false;
+		}
+		r.init_shard(fname, shard, nshards);
+		return true;
+	}
+	bool operator()(Inactive & r) const {
+		LOG_ERROR << r.name << " is not active";
+		return false;
+	}
+};
 
-	AllProcesses[4] = std::vector<Process>();
-	AllProcesses[4].push_back( Rate22("Boltzmann/cq2cq", path, dX_Qq2Qq_dt) );
-	AllProcesses[4].push_back( Rate22("Boltzmann/cg2cg", path, dX_Qg2Qg_dt) );
-	AllProcesses[4].push_back( Rate23("Boltzmann/cq2cqg", path, M2_Qq2Qqg) );
-	AllProcesses[4].push_back( Rate23("Boltzmann/cg2cgg", path, M2_Qg2Qgg) );
-	AllProcesses[4].push_back( Rate32("Boltzmann/cqg2cq", path, Ker_Qqg2Qq) );
-	AllProcesses[4].push_back( Rate32("Boltzmann/cgg2cg", path, Ker_Qgg2Qg) );
+bool run_table_task(std::string process, std::string path, double mu,
+					table_task & task){
+	if (task.quantity != "xsection" && task.quantity != "rate") {
+		LOG_ERROR << "quantity must be xsection or rate";
+		return false;
+	}
+	initialize_mD_and_scale(1, mu);
+	build_processes(path);
+	for(auto & it : AllProcesses)
+		for(auto & r : it.second)
+			if (boost::apply_visitor(process_name(), r)
+				== "Boltzmann/"+process+"/rate")
+				return boost::apply_visitor(task, r);
+	LOG_ERROR << "process " << process << " not found";
+	return false;
+}
 
-    AllProcesses[5] = std::vector<Process>();
-    AllProcesses[5].push_back( Rate22("Boltzmann/bq2bq", path, dX_Qq2Qq_dt) );
-    AllProcesses[5].push_back( Rate22("Boltzmann/bg2bg", path, dX_Qg2Qg_dt) );
-    AllProcesses[5].push_back( Rate23("Boltzmann/bq2bqg", path, M2_Qq2Qqg) );
-    AllProcesses[5].push_back( Rate23("Boltzmann/bg2bgg", path, M2_Qg2Qgg) );
-	AllProcesses[5].push_back( Rate32("Boltzmann/bqg2bq", path, Ker_Qqg2Qq) );
-	AllProcesses[5].push_back( Rate32("Boltzmann/bgg2bg", path, Ker_Qgg2Qg) );
+bool generate_shard(std::string process, std::string quantity,
+					size_t shard, size_t nshards, std::string fname,
+					std::string path, double mu){
+	table_task task;
+	task.quantity = quantity;
+	task.fname = fname;
+	task.shard = shard;
+	task.nshards = nshards;
+	return run_table_task(process, path, mu, task);
+}
 
-	BOOST_FOREACH(Process& r, AllProcesses[4]) init_process(r, mode);
-	BOOST_FOREACH(Process& r, AllProcesses[5]) init_process(r, mode);
+bool merge_shards(std::string process, std::string quantity,
+				std::vector<std::string> shards, std::string fname,
+				std::string path, double mu){
+	table_task task;
+	task.quantity = quantity;
+	task.fname = fname;
+	task.shards = shards;
+	return run_table_task(process, path, mu, task);
 }
 
 int update_particle_momentum(double dt, double temp, std::vector<double> v3cell,
 			int pid, double D_formation_t23, double D_formation_t32, fourvec incoming_p, std::vector<fourvec> & FS){
-	int absid = std::abs(pid);
-	auto p_cell = incoming_p.boost_to(v3cell[0], v3cell[1], v3cell[2]);
-	double D_formation_t23_cell = D_formation_t23 / incoming_p.t() * p_cell.t();
-	double D_formation_t32_cell = D_formation_t32 / incoming_p.t() * p_cell.t();
-	double dt_cell = dt / incoming_p.t() * p_cell.t();
-	double E_cell = p_cell.t();
-        std::vector<double> P_channels(AllProcesses[absid].size());
-	double P_total = 0.;
-	int channel = 0;
-	double dR;
-	BOOST_FOREACH(Process& r, AllProcesses[absid]){
-		switch(r.which()){
-			case 0:
-				if (boost::get<Rate22>(r).IsActive())
-					dR = boost::get<Rate22>(r).GetZeroM(
-												{E_cell, temp}).s * dt_cell;
-				else dR = 0.0;
-				P_channels[channel] = P_total + dR;
-				break;
-			case 1:
-				if (boost::get<Rate23>(r).IsActive())
-					dR = boost::get<Rate23>(r).GetZeroM(
-									{E_cell, temp, D_formation_t23_cell}).s * dt_cell;
-				else dR = 0.0;
-				P_channels[channel] = P_total + dR;
-				break;
-			case 2:
-				if (boost::get<Rate32>(r).IsActive())
-					dR = boost::get<Rate32>(r).GetZeroM(
-									{E_cell, temp, D_formation_t32_cell}).s * dt_cell;
-				else dR = 0.0;
-				P_channels[channel] = P_total + dR;
-				break;
-			default:
-				exit(-1);
-				break;
-		}
-		P_total += dR;
-		channel ++;
+	static thread_local UpdateScratch scratch;
+	FinalStates out;
+	int channel = update_particle_momentum(dt, temp, v3cell.data(), pid,
+					D_formation_t23, D_formation_t32, incoming_p, scratch, out);
+	if (channel >= 0) FS.assign(out.p, out.p+out.size);
+	return channel;
+}
+
+// Each component of the interpolation of the fused table is a weighted
+// mean of its grid values over its approximant, times the approximant, so
+// it is bounded by the largest of them around the grid cells reached, times
+// the approximant at Tmax and at the largest dt23, which total_rate keeps to
+double max_total_rate(int pid, double Emax, double Tmax){
+	const Species & S = species(std::abs(pid));
+	double bound[2] = {Emax, Tmax};
+	size_t top[2];
+	for(size_t d=0; d<2; ++d){
+		double x = std::max((bound[d]-S.low[d])/S.step[d], 0.);
+		top[d] = std::min(size_t(x)+1, S.shape[d]-1);
 	}
-	for(auto& item : P_channels) {item /= P_total;}
+	fourvec n{0., 0., 0., 0.};
+	for(size_t i=0; i<=top[0]; ++i)
+		for(size_t j=0; j<=top[1]; ++j)
+			n = max_components(n, S.max_rate[i*S.shape[1]+j]);
+	double x[4] = {Emax, Tmax, S.low[2] + S.step[2]*(S.shape[2]-1), 0.};
+	fourvec a = approx_total(x);
+	return n.t()*a.t() + n.x()*a.x() + n.y()*a.y();
+}
+
+size_t energy_bin(int pid, double E){
+	const Species & S = species(std::abs(pid));
+	double x = std::max((E-S.low[0])/S.step[0], 0.);
+	return std::min(size_t(x), S.shape[0]-1);
+}
+
+double total_rate(double temp, const double * v3cell, int pid,
+			double D_formation_t23, double D_formation_t32,
+			const fourvec & incoming_p){
+	auto p_cell = incoming_p.boost_to(v3cell[0], v3cell[1], v3cell[2]);
+	double dilation = p_cell.t() / incoming_p.t();
+	const Species & S = species(std::abs(pid));
+	// above the grid, the approximant of 2->3 is taken at its largest dt23
+	double high23 = S.low[2] + S.step[2]*(S.shape[2]-1);
+	double x[4] = {p_cell.t(), temp, std::min(D_formation_t23*dilation, high23),
+				   D_formation_t32*dilation};
+	fourvec R = S.total->InterpolateTable(x);
+	return (R.t() + R.x() + R.y()) * dilation;
+}
+
+double scattering_probability(double dt, double temp, const double * v3cell,
+			int pid, double D_formation_t23, double D_formation_t32,
+			const fourvec & incoming_p){
+	double P_total = total_rate(temp, v3cell, pid, D_formation_t23,
+								D_formation_t32, incoming_p) * dt;
 	if (P_total > 0.15) LOG_WARNING << "P_total = " << P_total << " may be too large";
-	if ( Srandom::init_dis(Srandom::gen) > P_total) return -1;
+	return P_total;
+}
+
+bool choose_channel(double temp, const double * v3cell, int pid,
+			double D_formation_t23, double D_formation_t32,
+			const fourvec & incoming_p, Scattering & s){
+	s.pid = pid;
+	s.temp = temp;
+	for(size_t i=0; i<3; ++i) s.v3cell[i] = v3cell[i];
+	s.p_cell = incoming_p.boost_to(v3cell[0], v3cell[1], v3cell[2]);
+	s.D23_cell = D_formation_t23 / incoming_p.t() * s.p_cell.t();
+	s.D32_cell = D_formation_t32 / incoming_p.t() * s.p_cell.t();
+	double E_cell = s.p_cell.t();
+	const Species & S = species(std::abs(pid));
+	// the channels are only looked up now to pick one,
+	// in the order 2->2, 2->3, 3->2
+	double x[3] = {E_cell, temp, s.D23_cell};
+	double x32[3] = {E_cell, temp, s.D32_cell};
+	double P_channels[max_channels];
+	size_t n = 0;
+	for(auto r : S.r22.rates) P_channels[n++] = r->GetZeroM(x).s;
+	for(auto r : S.r23.rates) P_channels[n++] = r->GetZeroM(x).s;
+	for(auto r : S.r32.rates) P_channels[n++] = r->GetZeroM(x32).s;
+	for(size_t i=1; i<n; ++i) P_channels[i] += P_channels[i-1];
+	if (n == 0 || P_channels[n-1] <= 0.) return false;
+	double p = Srandom::init_dis(Srandom::gen)*P_channels[n-1];
+	size_t k = 0;
+	while (k < n-1 && P_channels[k] <= p) k++;
+	s.slot = k;
+	return true;
+}
+
+int sample_channel_local(const Scattering & s, UpdateScratch & scratch,
+			FinalStates & FS){
+	const Species & S = species(std::abs(s.pid));
+	double E_cell = s.p_cell.t();
+	size_t k = s.slot;
+	int channel;
+	auto & arg2 = scratch.arg2;
+	auto & arg3 = scratch.arg3;
+	if (k < S.r22.size()){
+		channel = S.r22.ids[k];
+		arg2[0] = E_cell; arg2[1] = s.temp;
+		S.r22.rates[k]->sample(arg2, scratch.FS);
+	}
+	else if ((k -= S.r22.size()) < S.r23.size()){
+		channel = S.r23.ids[k];
+		arg3[0] = E_cell; arg3[1] = s.temp; arg3[2] = s.D23_cell;
+		S.r23.rates[k]->sample(arg3, scratch.FS);
+	}
 	else{
-		double p = Srandom::init_dis(Srandom::gen);
-		for(int i=0; i<P_channels.size(); ++i){
-			if (P_channels[i] > p) {
-				channel = i;
-				break;
-			}
-		}
+		k -= S.r23.size();
+		channel = S.r32.ids[k];
+		arg3[0] = E_cell; arg3[1] = s.temp; arg3[2] = s.D32_cell;
+		S.r32.rates[k]->sample(arg3, scratch.FS);
 	}
-	// Do scattering
-	switch(AllProcesses[absid][channel].which()){
-		case 0:
-			boost::get<Rate22>(AllProcesses[absid][channel]).sample({E_cell, temp}, FS);
-			break;
-		case 1:
-			boost::get<Rate23>(AllProcesses[absid][channel]).sample(
-											{E_cell, temp, D_formation_t23_cell}, FS);
-			break;
-		case 2:
-			boost::get<Rate32>(AllProcesses[absid][channel]).sample(
-											{E_cell, temp, D_formation_t32_cell}, FS);
-			break;
-		default:
-			LOG_FATAL << "Channel = " << channel << " not exists";
-			exit(-1);
-			break;
+	if (scratch.FS.size() > FinalStates::capacity) {
+		LOG_FATAL << "Channel = " << channel << " gives "
+				  << scratch.FS.size() << " final states";
+		exit(-1);
 	}
+	FS.size = scratch.FS.size();
+	std::copy(scratch.FS.begin(), scratch.FS.end(), FS.p);
+	return channel;
+}
+
+void to_lab(const Scattering & s, FinalStates & FS){
 	// rotate it back and boost it back
-	for(auto & pmu : FS) {
-		pmu = pmu.rotate_back(p_cell);
-		pmu = pmu.boost_back(v3cell[0], v3cell[1], v3cell[2]);
+	for(size_t i=0; i<FS.size; ++i) {
+		FS.p[i] = FS.p[i].rotate_back(s.p_cell);
+		FS.p[i] = FS.p[i].boost_back(s.v3cell[0], s.v3cell[1], s.v3cell[2]);
 	}
+}
+
+int sample_channel(const Scattering & s, UpdateScratch & scratch, FinalStates & FS){
+	int channel = sample_channel_local(s, scratch, FS);
+	to_lab(s, FS);
 	return channel;
 }
 
 
+int scatter(double temp, const double * v3cell, int pid,
+			double D_formation_t23, double D_formation_t32,
+			const fourvec & incoming_p, UpdateScratch & scratch, FinalStates & FS){
+	Scattering s;
+	if (!choose_channel(temp, v3cell, pid, D_formation_t23, D_formation_t32,
+						incoming_p, s)) return -1;
+	return sample_channel(s, scratch, FS);
+}
+
+int update_particle_momentum(double dt, double temp, const double * v3cell,
+			int pid, double D_formation_t23, double D_formation_t32,
+			const fourvec & incoming_p, UpdateScratch & scratch, FinalStates & FS){
+	// whether anything happens at all, from the fused table of all channels
+	double P_total = scattering_probability(dt, temp, v3cell, pid,
+					D_formation_t23, D_formation_t32, incoming_p);
+	if ( Srandom::init_dis(Srandom::gen) > P_total) return -1;
+	return scatter(temp, v3cell, pid, D_formation_t23, D_formation_t32,
+				   incoming_p, scratch, FS);
+}
+
+
 std::vector<double> probe_test(double E0, double T, double dt=0.05, int Nsteps=100, int Nparticles=10000, std::string mode="old"){
 	double fmc_to_GeV_m1 = 5.026;
 	initialize(mode, "./settings.xml", 1.0);
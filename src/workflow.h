@@ -28,11 +28,112 @@ struct particle{
 typedef Rate<2, 2, double(*)(const double, void*)> Rate22;
 typedef Rate<3, 3, double(*)(const double*, void*)> Rate23;
 typedef Rate<3, 4, double(*)(const double*, void*)> Rate32;
-typedef boost::variant<Rate22, Rate23, Rate32> Process;
+// a process switched off in the settings, it is not constructed but
+// keeps the channel numbers of the others
+struct Inactive{
+	std::string name;
+	std::string Name(void) {return name+"/rate";}
+};
+typedef boost::variant<Rate22, Rate23, Rate32, Inactive> Process;
 extern std::map<int, std::vector<Process>> AllProcesses;
+// The active channels of one heavy quark species, held by their concrete
+// type so that update_particle_momentum needs no variant dispatch nor map
+// lookup. Built once by initialize(), it points into AllProcesses.
+template <typename R>
+struct Channels{
+	std::vector<R*> rates;
+	std::vector<int> ids; // channel number, the index in AllProcesses
+	size_t size(void) const {return rates.size();}
+};
+struct Species{
+	// sums of the rates of the 2->2, 2->3 and 3->2 channels over
+	// (E, T, dt23, dt32), in t, x and y, each interpolated over the
+	// approximant of its channels
+	std::shared_ptr<TableBase<fourvec, 4>> total;
+	// max over dt23, dt32 of each sum over its approximant at each (E, T)
+	// grid point; the grid is low + step*i of shape NE x NT x Ndt23 x Ndt32
+	std::vector<fourvec> max_rate;
+	double low[4], step[4];
+	size_t shape[4];
+	Channels<Rate22> r22;
+	Channels<Rate23> r23;
+	Channels<Rate32> r32;
+};
+void build_processes(std::string path);
 void initialize(std::string, std::string path, double mu);
+// Distributed table generation: each job computes shard k of M of the
+// "xsection" or "rate" table of one process (e.g. "cq2cqg") into its own
+// file, merge_shards assembles them into the tables of fname. A rate shard
+// needs the merged xsection table in table.h5.
+bool generate_shard(std::string process, std::string quantity,
+					size_t shard, size_t nshards, std::string fname,
+					std::string path, double mu);
+bool merge_shards(std::string process, std::string quantity,
+				std::vector<std::string> shards, std::string fname,
+				std::string path, double mu);
 int update_particle_momentum(double dt, double temp, std::vector<double> v3cell, int pid,
 				double D_formation_t23, double D_formation_t32, fourvec incoming_p, std::vector<fourvec> & FS);
+// final states of a scattering, no process gives more than 3
+struct FinalStates{
+	static const size_t capacity = 4;
+	fourvec p[capacity];
+	size_t size;
+	FinalStates(): size(0) {}
+};
+// buffers reused from one call of update_particle_momentum to the next,
+// a thread keeps one for all its calls
+struct UpdateScratch{
+	std::vector<double> arg2, arg3;
+	std::vector<fourvec> FS;
+	UpdateScratch(): arg2(2), arg3(3) {FS.reserve(FinalStates::capacity);}
+};
+// The two halves of update_particle_momentum, for steppers that draw
+// the time of the next scattering themselves: the total rate of scattering
+// per unit of lab time [GeV], and the scattering of a particle known to
+// scatter. The time differences are in GeV^-1.
+double total_rate(double temp, const double * v3cell, int pid,
+				double D_formation_t23, double D_formation_t32, const fourvec & incoming_p);
+int scatter(double temp, const double * v3cell, int pid,
+				double D_formation_t23, double D_formation_t32, const fourvec & incoming_p,
+				UpdateScratch & scratch, FinalStates & FS);
+// the probability total_rate*dt of a single trial of scattering over the
+// lab time dt, with a warning when it is too large for one trial
+double scattering_probability(double dt, double temp, const double * v3cell,
+				int pid, double D_formation_t23, double D_formation_t32,
+				const fourvec & incoming_p);
+// The two steps of scatter, for steppers that decide the scatterings of
+// many particles before sampling any: the channel of a particle known to
+// scatter, false if none is open, then its final states. A Scattering
+// holds the chosen channel, as the slot among those of the species (2->2,
+// then 2->3, then 3->2), and the kinematics in the cell frame.
+struct Scattering{
+	int pid;
+	size_t slot;
+	double temp, v3cell[3];
+	fourvec p_cell;
+	double D23_cell, D32_cell;
+};
+bool choose_channel(double temp, const double * v3cell, int pid,
+				double D_formation_t23, double D_formation_t32, const fourvec & incoming_p,
+				Scattering & s);
+// returns the channel number
+int sample_channel(const Scattering & s, UpdateScratch & scratch, FinalStates & FS);
+// sample_channel in two steps: the final states in the frame of the
+// sampling, the cell frame rotated so that the particle moves along z,
+// then their rotation and boost to the lab frame
+int sample_channel_local(const Scattering & s, UpdateScratch & scratch,
+				FinalStates & FS);
+void to_lab(const Scattering & s, FinalStates & FS);
+// bound of the total rate in the cell frame [GeV], for cell energies below
+// Emax and temperatures below Tmax
+double max_total_rate(int pid, double Emax, double Tmax);
+// index of the energy E on the grid of the total rate table of pid
+size_t energy_bin(int pid, double E);
+// same as above without heap allocation, v3cell points to 3 components;
+// only the sampling inside a 2->3 or 3->2 process may still allocate
+int update_particle_momentum(double dt, double temp, const double * v3cell, int pid,
+				double D_formation_t23, double D_formation_t32, const fourvec & incoming_p,
+				UpdateScratch & scratch, FinalStates & FS);
 
 std::vector<double> probe_test(double E0, double T, double dt, int Nsteps,
 				int Nparticles, std::string mode);